@@ -0,0 +1,499 @@
+/*
+ * Copyright 2009-2011 IPOL Image Processing On Line http://www.ipol.im/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file bench.c
+ * @brief pipeline stage benchmark
+ *
+ * Every stage of the retinex pipeline is timed separately, for a
+ * matrix of image sizes, numbers of threads, DCT planning rigors,
+ * padding modes (see retinex_pde_padding()) and Poisson solvers (see
+ * retinex_pde_solver(); dct_double and dct_long are the DCT solver
+ * with the retinex_pde_precision() variants):
+ * @li plan: solver context setup, DCT planning included (once)
+ * @li laplacian, dct_fw, poisson, dct_bw: the retinex_pde_ctx_run()
+ *     steps, with the DCT solver
+ * @li multigrid: the Poisson solve, with the multigrid solver
+ * @li normalize: normalize_mean_dt() on every channel
+ * @li png_write, png_read: PNG encoding and decoding, with a
+ *     temporary file
+ *
+ * The results are printed on stdout, one CSV line per stage and
+ * configuration, with the minimum, median and mean wall time over the
+ * runs, in seconds, the memory used by the solver context, in bytes,
+ * and the accuracy, the maximum absolute difference between the
+ * normalized output and the output of the long double DCT solver,
+ * without padding, in [0,1] units (1/255 is one 8bit level). The
+ * in-process FFTW wisdom is cleared between
+ * configurations, so the plan times do not depend on the order. The
+ * cache behaviour can be measured by running the benchmark with a
+ * profiler, for example `perf stat -e cache-misses`, one solver at a
+ * time.
+ *
+ * The test image is a deterministic mix of gradients and noise.
+ */
+
+/* POSIX: monotonic clock */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "retinex_pde_lib.h"
+#include "io_png.h"
+#include "norm.h"
+
+/** default image sizes, with non power of 2 and prime sizes */
+#define BENCH_SIZES "256x256,512x512,1024x1024,2048x2048,1000x1000," \
+    "1021x1021,2039x2053,512x512x3,1024x1024x3"
+/** default planning rigors */
+#define BENCH_PLANS "estimate,measure"
+/** default padding modes */
+#define BENCH_PADS "0"
+/** default solvers */
+#define BENCH_SOLVERS "dct,dct_double,multigrid"
+/** default number of runs */
+#define BENCH_RUNS 5
+/** retinex threshold */
+#define BENCH_T .05
+
+/** stages, in pipeline order */
+enum { PLAN, LAPLACIAN, DCT_FW, POISSON, DCT_BW, MULTIGRID, NORMALIZE,
+    PNG_WRITE, PNG_READ, NSTAGE
+};
+static const char *stage_name[NSTAGE] = {
+    "plan", "laplacian", "dct_fw", "poisson", "dct_bw", "multigrid",
+    "normalize", "png_write", "png_read"
+};
+
+/**
+ * @brief print the usage info
+ */
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage : %s [-s sizes] [-j threads] [-p plans] "
+            "[-P pads] [-S solvers] [-n runs]\n", name);
+    fprintf(stderr, "        -s WxH[xC],...   image sizes\n");
+    fprintf(stderr, "                         (default: %s)\n",
+            BENCH_SIZES);
+    fprintf(stderr, "        -j N,...         numbers of threads "
+            "(default: 1 and all the CPUs)\n");
+    fprintf(stderr, "        -p plan,...      estimate, measure or "
+            "patient (default: %s)\n", BENCH_PLANS);
+    fprintf(stderr, "        -P 0|1,...       without or with padding "
+            "(default: %s)\n", BENCH_PADS);
+    fprintf(stderr, "        -S solver,...    dct, dct_double, dct_long "
+            "or multigrid\n");
+    fprintf(stderr, "                         (default: %s)\n",
+            BENCH_SOLVERS);
+    fprintf(stderr, "        -n runs          timed runs, after a "
+            "warm-up (default: %d)\n", BENCH_RUNS);
+    return;
+}
+
+/**
+ * @brief wall clock time, in seconds
+ */
+static double wall_time(void)
+{
+#if defined(_OPENMP)
+    return omp_get_wtime();
+#elif defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0)
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1E-9 * (double) ts.tv_nsec;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/** double comparison for qsort() */
+static int dbl_cmp(const void *a, const void *b)
+{
+    double da = *(const double *) a, db = *(const double *) b;
+
+    return (da < db ? -1 : (da > db ? 1 : 0));
+}
+
+/**
+ * @brief print the timings of a stage
+ *
+ * @param plan planning rigor name, up to a comma
+ * @param solver solver name, up to a comma
+ * @param time run times, sorted
+ * @param mem solver context memory
+ * @param err maximum error of the output
+ */
+static void report(int stage, size_t nx, size_t ny, size_t nc,
+                   int nthreads, const char *plan, int pad,
+                   const char *solver, double *time, int runs, size_t mem,
+                   double err)
+{
+    double mean = 0.;
+    int i;
+
+    qsort(time, runs, sizeof(double), &dbl_cmp);
+    for (i = 0; i < runs; i++)
+        mean += time[i];
+    mean /= runs;
+    printf("%s,%lu,%lu,%lu,%d,%.*s,%d,%.*s,%d,%.6e,%.6e,%.6e,%lu,%.3e\n",
+           stage_name[stage], (unsigned long) nx, (unsigned long) ny,
+           (unsigned long) nc, nthreads, (int) strcspn(plan, ","), plan,
+           pad, (int) strcspn(solver, ","), solver, runs, time[0],
+           time[runs / 2], mean, (unsigned long) mem, err);
+}
+
+/**
+ * @brief fill the test image
+ */
+static void test_image(float *data, size_t nx, size_t ny, size_t nc)
+{
+    unsigned long rnd = 1;
+    size_t x, y, c;
+    float *ptr = data;
+
+    for (c = 0; c < nc; c++)
+        for (y = 0; y < ny; y++)
+            for (x = 0; x < nx; x++) {
+                rnd = (rnd * 1103515245UL + 12345UL) & 0x7fffffffUL;
+                *ptr++ = (.25 * (float) x / nx + .25 * (float) y / ny
+                          + .1 * c + .4 * (float) (rnd >> 8) / 0x800000);
+            }
+}
+
+/**
+ * @brief reference output, with the long double DCT solver
+ *
+ * The reference is planned with FFTW_ESTIMATE, the slow long double
+ * planning is not repeated at every rigor, and the planning rigor is
+ * left to FFTW_ESTIMATE.
+ *
+ * @return the normalized output, allocated with malloc()
+ */
+static float *reference(const float *data_in, size_t nx, size_t ny,
+                        size_t nc)
+{
+    retinex_pde_ctx_t *ctx;
+    float *data;
+    size_t size, c;
+
+    size = nx * ny;
+    if (NULL == (data = (float *) malloc(size * nc * sizeof(float)))) {
+        fprintf(stderr, "allocation error\n");
+        abort();
+    }
+    memcpy(data, data_in, size * nc * sizeof(float));
+    retinex_pde_plan_rigor(RETINEX_PDE_PLAN_ESTIMATE);
+    retinex_pde_padding(0);
+    retinex_pde_solver(RETINEX_PDE_SOLVER_DCT);
+    retinex_pde_precision(RETINEX_PDE_PRECISION_LONG_DOUBLE);
+    ctx = retinex_pde_ctx_new(nx, ny, nc);
+    (void) retinex_pde_ctx_run(ctx, data, BENCH_T);
+    retinex_pde_ctx_free(ctx);
+    for (c = 0; c < nc; c++)
+        normalize_mean_dt(data + c * size, data_in + c * size, size);
+    return data;
+}
+
+/**
+ * @brief benchmark one configuration
+ *
+ * @param plan planning rigor name, up to a comma
+ * @param rigor planning rigor
+ * @param solver solver name, up to a comma
+ * @param multigrid 1 for the multigrid solver, 0 for the DCT
+ * @param precision DCT precision
+ */
+static void bench(size_t nx, size_t ny, size_t nc, int nthreads,
+                  const char *plan, retinex_pde_plan_t rigor, int pad,
+                  const char *solver, int multigrid,
+                  retinex_pde_precision_t precision, int runs)
+{
+    retinex_pde_ctx_t *ctx;
+    float *data_in, *data, *data_ref, *data_png;
+    double *time[NSTAGE];
+    double start, err, diff;
+    size_t size, c, pnx, pny, pnc, mem;
+    FILE *fp;
+    int s, i;
+
+    size = nx * ny;
+    if (NULL == (data_in = (float *) malloc(size * nc * sizeof(float)))
+        || NULL == (data = (float *) malloc(size * nc * sizeof(float)))) {
+        fprintf(stderr, "allocation error\n");
+        abort();
+    }
+    for (s = 0; s < NSTAGE; s++)
+        if (NULL == (time[s] = (double *) malloc(runs * sizeof(double)))) {
+            fprintf(stderr, "allocation error\n");
+            abort();
+        }
+    test_image(data_in, nx, ny, nc);
+
+    data_ref = reference(data_in, nx, ny, nc);
+    /* forget the reference wisdom, then plan with the threads */
+    retinex_pde_cleanup();
+    retinex_pde_threads(nthreads);
+    retinex_pde_plan_rigor(rigor);
+    retinex_pde_padding(pad);
+    retinex_pde_solver(multigrid ? RETINEX_PDE_SOLVER_MULTIGRID
+                       : RETINEX_PDE_SOLVER_DCT);
+    retinex_pde_precision(precision);
+    start = wall_time();
+    ctx = retinex_pde_ctx_new(nx, ny, nc);
+    time[PLAN][0] = wall_time() - start;
+    mem = retinex_pde_ctx_memory(ctx);
+
+    /* the first run is a warm-up */
+    for (i = -1; i < runs; i++) {
+        memcpy(data, data_in, size * nc * sizeof(float));
+
+        start = wall_time();
+        retinex_pde_ctx_laplacian(ctx, data, BENCH_T);
+        if (0 <= i)
+            time[LAPLACIAN][i] = wall_time() - start;
+
+        if (multigrid) {
+            start = wall_time();
+            (void) retinex_pde_ctx_multigrid(ctx, data);
+            if (0 <= i)
+                time[MULTIGRID][i] = wall_time() - start;
+        }
+        else {
+            start = wall_time();
+            retinex_pde_ctx_dct_fw(ctx);
+            if (0 <= i)
+                time[DCT_FW][i] = wall_time() - start;
+
+            start = wall_time();
+            retinex_pde_ctx_poisson(ctx);
+            if (0 <= i)
+                time[POISSON][i] = wall_time() - start;
+
+            start = wall_time();
+            (void) retinex_pde_ctx_dct_bw(ctx, data);
+            if (0 <= i)
+                time[DCT_BW][i] = wall_time() - start;
+        }
+
+        start = wall_time();
+        for (c = 0; c < nc; c++)
+            normalize_mean_dt(data + c * size, data_in + c * size, size);
+        if (0 <= i)
+            time[NORMALIZE][i] = wall_time() - start;
+
+        /* PNG, 4 channels at most */
+        if (NULL == (fp = tmpfile())) {
+            fprintf(stderr, "the temporary file could not be created\n");
+            abort();
+        }
+        start = wall_time();
+        io_png_write_flt_stream(fp, data, nx, ny, (4 < nc ? 4 : nc));
+        if (0 <= i)
+            time[PNG_WRITE][i] = wall_time() - start;
+
+        rewind(fp);
+        start = wall_time();
+        data_png = io_png_read_flt_stream(fp, &pnx, &pny, &pnc);
+        if (0 <= i)
+            time[PNG_READ][i] = wall_time() - start;
+        free(data_png);
+        (void) fclose(fp);
+    }
+    retinex_pde_ctx_free(ctx);
+    /* forget the wisdom, for the next configuration */
+    retinex_pde_cleanup();
+
+    /* accuracy of the last run */
+    err = 0.;
+    for (c = 0; c < size * nc; c++) {
+        diff = (double) data[c] - (double) data_ref[c];
+        if (diff > err || -diff > err)
+            err = (diff > 0. ? diff : -diff);
+    }
+
+    report(PLAN, nx, ny, nc, nthreads, plan, pad, solver, time[PLAN], 1,
+           mem, err);
+    for (s = PLAN + 1; s < NSTAGE; s++)
+        if (multigrid ? (DCT_FW > s || DCT_BW < s) : MULTIGRID != s)
+            report(s, nx, ny, nc, nthreads, plan, pad, solver, time[s],
+                   runs, mem, err);
+    fflush(stdout);
+
+    for (s = 0; s < NSTAGE; s++)
+        free(time[s]);
+    free(data_ref);
+    free(data);
+    free(data_in);
+}
+
+/** next item of a comma-separated list */
+static const char *next_item(const char *list)
+{
+    list += strcspn(list, ",");
+    return (',' == *list ? list + 1 : list);
+}
+
+/** compare a list item with a name */
+static int item_is(const char *item, const char *name)
+{
+    return (strlen(name) == strcspn(item, ",")
+            && 0 == strncmp(item, name, strlen(name)));
+}
+
+/**
+ * @brief main function call
+ */
+int main(int argc, char *const *argv)
+{
+    const char *sizes = BENCH_SIZES;
+    const char *plans = BENCH_PLANS;
+    const char *pads = BENCH_PADS;
+    const char *solvers = BENCH_SOLVERS;
+    const char *threads = NULL;
+    char threads_default[32];
+    int runs = BENCH_RUNS;
+    const char *psize, *pthreads, *pplan, *ppad, *psolver;
+    char *end;
+    unsigned long nx, ny, nc;
+    long nthreads, pad;
+    int i, multigrid;
+    retinex_pde_precision_t precision;
+    retinex_pde_plan_t rigor;
+
+    for (i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (0 == strcmp("-s", argv[i]))
+            sizes = argv[++i];
+        else if (0 == strcmp("-j", argv[i]))
+            threads = argv[++i];
+        else if (0 == strcmp("-p", argv[i]))
+            plans = argv[++i];
+        else if (0 == strcmp("-P", argv[i]))
+            pads = argv[++i];
+        else if (0 == strcmp("-S", argv[i]))
+            solvers = argv[++i];
+        else if (0 == strcmp("-n", argv[i]))
+            runs = atoi(argv[++i]);
+        else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (1 > runs) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (NULL == threads) {
+        strcpy(threads_default, "1");
+#ifdef _OPENMP
+        if (1 < omp_get_num_procs())
+            sprintf(threads_default, "1,%d", omp_get_num_procs());
+#endif
+        threads = threads_default;
+    }
+
+    printf("stage,nx,ny,nc,threads,plan,pad,solver,runs,"
+           "min_s,median_s,mean_s,ctx_bytes,max_err\n");
+
+    for (pplan = plans; '\0' != *pplan; pplan = next_item(pplan)) {
+        if (item_is(pplan, "estimate"))
+            rigor = RETINEX_PDE_PLAN_ESTIMATE;
+        else if (item_is(pplan, "measure"))
+            rigor = RETINEX_PDE_PLAN_MEASURE;
+        else if (item_is(pplan, "patient"))
+            rigor = RETINEX_PDE_PLAN_PATIENT;
+        else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        for (pthreads = threads; '\0' != *pthreads;
+             pthreads = next_item(pthreads)) {
+            nthreads = strtol(pthreads, &end, 10);
+            if (1 > nthreads || (',' != *end && '\0' != *end)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+
+            for (ppad = pads; '\0' != *ppad; ppad = next_item(ppad)) {
+                pad = strtol(ppad, &end, 10);
+                if ((0 != pad && 1 != pad)
+                    || (',' != *end && '\0' != *end)) {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+
+                for (psize = sizes; '\0' != *psize;
+                     psize = next_item(psize)) {
+                    nx = strtoul(psize, &end, 10);
+                    ny = 0;
+                    if ('x' == *end)
+                        ny = strtoul(end + 1, &end, 10);
+                    nc = 1;
+                    if ('x' == *end)
+                        nc = strtoul(end + 1, &end, 10);
+                    if (0 == nx || 0 == ny || 0 == nc
+                        || (',' != *end && '\0' != *end)) {
+                        usage(argv[0]);
+                        return EXIT_FAILURE;
+                    }
+                    for (psolver = solvers; '\0' != *psolver;
+                         psolver = next_item(psolver)) {
+                        multigrid = 0;
+                        precision = RETINEX_PDE_PRECISION_FLOAT;
+                        if (item_is(psolver, "dct_double"))
+                            precision = RETINEX_PDE_PRECISION_DOUBLE;
+                        else if (item_is(psolver, "dct_long"))
+                            precision = RETINEX_PDE_PRECISION_LONG_DOUBLE;
+                        else if (item_is(psolver, "multigrid"))
+                            multigrid = 1;
+                        else if (!item_is(psolver, "dct")) {
+                            usage(argv[0]);
+                            return EXIT_FAILURE;
+                        }
+                        /*
+                         * the multigrid solver ignores the planning
+                         * rigor and the padding, run it once
+                         */
+                        if (multigrid && (pplan != plans || 0 != pad))
+                            continue;
+                        /* the wider DCT ignores the padding */
+                        if (RETINEX_PDE_PRECISION_FLOAT != precision
+                            && 0 != pad)
+                            continue;
+                        bench((size_t) nx, (size_t) ny, (size_t) nc,
+                              (int) nthreads, pplan, rigor, (int) pad,
+                              psolver, multigrid, precision, runs);
+                    }
+                }
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
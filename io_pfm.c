@@ -0,0 +1,263 @@
+/*
+ * Copyright 2009-2011 IPOL Image Processing On Line http://www.ipol.im/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file io_pfm.c
+ * @brief PFM (portable float map) image read/write
+ *
+ * A PFM file is a text header, "PF" (RGB) or "Pf" (gray), the width
+ * and height, and a scale whose sign gives the byte order (negative
+ * for little-endian), followed by the 32bit float samples, interleaved
+ * (RGB RGB RGB), from the bottom row to the top row.
+ *
+ * The samples are read into, and written from, planar float arrays
+ * (RRR GGG BBB, top row first), as io_png.c, one row at a time,
+ * without clamping nor quantization, so high dynamic range values
+ * are kept. The absolute value of the scale is ignored, and the
+ * files are written in the native byte order, with a scale of 1.
+ *
+ * PFM has no alpha channel: gray+alpha images are written as gray,
+ * and RGBA images as RGB. Sequences of PFM images are read from and
+ * written to open streams, one image after the other.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* unified Windows detection, see io_png.c */
+#if (defined(_WIN32) || defined(__WIN32__) \
+     || defined(__TOS_WIN__) || defined(__WINDOWS__))
+#ifndef WIN32
+#define WIN32
+#endif
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+/* ensure consistency */
+#include "io_pfm.h"
+
+/*
+ * UTILS
+ */
+
+/** @brief abort() wrapper macro with an error message */
+#define _IO_PFM_ABORT(MSG) do {                                 \
+    fprintf(stderr, "%s:%04u : %s\n", __FILE__, __LINE__, MSG); \
+    fflush(stderr);                                             \
+    abort();                                                    \
+    } while (0);
+
+/** @brief safe malloc wrapper */
+static void *_io_pfm_safe_malloc(size_t size)
+{
+    void *memptr;
+
+    if (NULL == (memptr = malloc(size)))
+        _IO_PFM_ABORT("not enough memory");
+    return memptr;
+}
+
+/** @brief 1 on a little-endian host, 0 on a big-endian host */
+static int _io_pfm_little_endian(void)
+{
+    unsigned int one = 1;
+
+    return (1 == *(unsigned char *) &one);
+}
+
+/** @brief reverse the byte order of n 32bit floats */
+static void _io_pfm_swap(float *row, size_t n)
+{
+    unsigned char *ptr, tmp;
+    size_t i;
+
+    ptr = (unsigned char *) row;
+    for (i = 0; i < n; i++, ptr += 4) {
+        tmp = ptr[0];
+        ptr[0] = ptr[3];
+        ptr[3] = tmp;
+        tmp = ptr[1];
+        ptr[1] = ptr[2];
+        ptr[2] = tmp;
+    }
+}
+
+/*
+ * READ
+ */
+
+/**
+ * @brief read a PFM image from an open stream
+ *
+ * The stream is left after the image data, for the next image of a
+ * sequence.
+ *
+ * @param fp input stream
+ * @param nxp, nyp, ncp pointers to the image size, filled
+ *
+ * @return pointer to an allocated planar float array, abort() on error
+ */
+float *io_pfm_read_stream(FILE *fp, size_t *nxp, size_t *nyp, size_t *ncp)
+{
+    char magic[3];
+    unsigned long nx, ny;
+    double scale;
+    size_t nc, x, y, c;
+    float *data, *row, *ptr;
+    int swap, end;
+
+    if (1 != fscanf(fp, "%2s", magic)
+        || 'P' != magic[0] || ('F' != magic[1] && 'f' != magic[1])
+        || 3 != fscanf(fp, "%lu %lu %lf", &nx, &ny, &scale)
+        || 0 == nx || 0 == ny || 0. == scale)
+        _IO_PFM_ABORT("bad PFM header");
+    nc = ('F' == magic[1] ? 3 : 1);
+    /* the float array size must not overflow */
+    if ((size_t) -1 / sizeof(float) / nc / ny < nx)
+        _IO_PFM_ABORT("bad PFM header");
+    /* a single whitespace before the samples */
+    end = getc(fp);
+    if (' ' != end && '\n' != end && '\r' != end && '\t' != end)
+        _IO_PFM_ABORT("bad PFM header");
+    swap = ((0. > scale) != _io_pfm_little_endian());
+
+    data = (float *) _io_pfm_safe_malloc(nx * ny * nc * sizeof(float));
+    row = (float *) _io_pfm_safe_malloc(nx * nc * sizeof(float));
+    /* bottom to top interleaved rows -> top to bottom planar array */
+    for (y = ny; y-- > 0;) {
+        if (nx * nc != fread(row, sizeof(float), nx * nc, fp))
+            _IO_PFM_ABORT("PFM file too short");
+        if (swap)
+            _io_pfm_swap(row, nx * nc);
+        for (c = 0; c < nc; c++) {
+            ptr = data + (c * ny + y) * nx;
+            for (x = 0; x < nx; x++)
+                ptr[x] = row[x * nc + c];
+        }
+    }
+    free(row);
+
+    *nxp = (size_t) nx;
+    *nyp = (size_t) ny;
+    *ncp = nc;
+    return data;
+}
+
+/**
+ * @brief read a PFM image file into a planar float array
+ *
+ * @param fname file name, "-" means stdin
+ * @param nxp, nyp, ncp pointers to the image size, filled
+ *
+ * @return pointer to an allocated planar float array, abort() on error
+ */
+float *io_pfm_read(const char *fname, size_t *nxp, size_t *nyp,
+                   size_t *ncp)
+{
+    FILE *fp;
+    float *data;
+
+    if (0 == strcmp(fname, "-")) {
+        fp = stdin;
+#ifdef WIN32                    /* set the stream to binary mode */
+        setmode(fileno(fp), O_BINARY);
+#endif
+    }
+    else if (NULL == (fp = fopen(fname, "rb")))
+        _IO_PFM_ABORT("failed to open file");
+
+    data = io_pfm_read_stream(fp, nxp, nyp, ncp);
+
+    if (stdin != fp)
+        (void) fclose(fp);
+    return data;
+}
+
+/*
+ * WRITE
+ */
+
+/**
+ * @brief write a planar float array to an open stream, as PFM
+ *
+ * Same as io_pfm_write(), the stream is left open, after the image
+ * data, and not flushed.
+ *
+ * @param fp output stream
+ * @param data planar float array
+ * @param nx, ny, nc image size
+ */
+void io_pfm_write_stream(FILE *fp, const float *data,
+                         size_t nx, size_t ny, size_t nc)
+{
+    const float *ptr;
+    float *row;
+    size_t x, y, c;
+
+    if (0 == nx || 0 == ny || 0 == nc)
+        _IO_PFM_ABORT("bad image size");
+    /* gray or RGB, the alpha channel is dropped */
+    nc = (3 <= nc ? 3 : 1);
+    if (0 > fprintf(fp, "%s\n%lu %lu\n%s\n", (3 == nc ? "PF" : "Pf"),
+                    (unsigned long) nx, (unsigned long) ny,
+                    (_io_pfm_little_endian() ? "-1.0" : "1.0")))
+        _IO_PFM_ABORT("failed to write file");
+
+    row = (float *) _io_pfm_safe_malloc(nx * nc * sizeof(float));
+    for (y = ny; y-- > 0;) {
+        for (c = 0; c < nc; c++) {
+            ptr = data + (c * ny + y) * nx;
+            for (x = 0; x < nx; x++)
+                row[x * nc + c] = ptr[x];
+        }
+        if (nx * nc != fwrite(row, sizeof(float), nx * nc, fp))
+            _IO_PFM_ABORT("failed to write file");
+    }
+    free(row);
+}
+
+/**
+ * @brief write a planar float array into a PFM file
+ *
+ * @param fname file name, "-" means stdout
+ * @param data planar float array
+ * @param nx, ny, nc image size
+ */
+void io_pfm_write(const char *fname, const float *data,
+                  size_t nx, size_t ny, size_t nc)
+{
+    FILE *fp;
+
+    if (0 == strcmp(fname, "-")) {
+        fp = stdout;
+#ifdef WIN32                    /* set the stream to binary mode */
+        fflush(fp);
+        setmode(fileno(fp), O_BINARY);
+#endif
+    }
+    else if (NULL == (fp = fopen(fname, "wb")))
+        _IO_PFM_ABORT("failed to open file");
+
+    io_pfm_write_stream(fp, data, nx, ny, nc);
+
+    if (stdout == fp)
+        (void) fflush(fp);
+    else if (0 != fclose(fp))
+        _IO_PFM_ABORT("failed to write file");
+}
@@ -0,0 +1,21 @@
+#ifndef _IO_PFM_H
+#define _IO_PFM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* io_pfm.c */
+float *io_pfm_read(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp);
+float *io_pfm_read_stream(FILE *fp, size_t *nxp, size_t *nyp, size_t *ncp);
+void io_pfm_write(const char *fname, const float *data, size_t nx, size_t ny, size_t nc);
+void io_pfm_write_stream(FILE *fp, const float *data, size_t nx, size_t ny, size_t nc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_IO_PFM_H */
@@ -25,7 +25,6 @@
  * rgb+alpha, as well as on-the-fly rgb/gray conversion.
  *
  * @todo add type width assertions
- * @todo handle 16bit data
  * @todo replace rgb/gray with sRGB / Y references
  * @todo implement sRGB gamma and better RGBY conversion
  * @todo process the data as float before quantization
@@ -36,6 +35,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <limits.h>
 #include <assert.h>
@@ -46,6 +46,12 @@
 #else
 #include <png.h>
 #endif
+/* zlib strategies, and deflate for the parallel encoder */
+#include <zlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 /* unified Windows detection */
 #if (defined(_WIN32) || defined(__WIN32__) \
@@ -102,6 +108,24 @@ static void *_io_png_safe_malloc(size_t size)
 #define _IO_PNG_SAFE_MALLOC(NB, TYPE)                                   \
     ((TYPE *) _io_png_safe_malloc((size_t) (NB) * sizeof(TYPE)))
 
+/**
+ * @brief reader malloc wrapper, png_error() on failure in noabort mode
+ *
+ * The libpng error handler then jumps back to the reader, see
+ * _io_png_read().
+ */
+static void *_io_png_read_malloc(png_structp png_ptr, int noabort,
+                                 size_t size)
+{
+    void *memptr;
+
+    if (!noabort)
+        return _io_png_safe_malloc(size);
+    if (NULL == (memptr = malloc(size)))
+        png_error(png_ptr, "not enough memory");
+    return memptr;
+}
+
 /** @brief safe realloc wrapper */
 static void *_io_png_safe_realloc(void *memptr, size_t size)
 {
@@ -146,59 +170,6 @@ static void _io_png_err_hdl(png_structp png_ptr, png_const_charp msg)
  * TYPE AND IMAGE FORMAT CONVERSION
  */
 
-typedef enum _io_png_inter_e {
-    INTERLACE,
-    DEINTERLACE
-} _io_png_inter_t;
-
-/**
- * @brief (de)interlace a float array
- *
- * @param data array to interlace
- * @param csize array size per channel
- * @param nc number of channels to interlace
- * @return new array
- */
-static float *_io_png_inter(const float *data, size_t csize, size_t nc,
-                            _io_png_inter_t option)
-{
-    size_t i, size;
-    float *tmp;
-
-    assert(NULL != data && 0 != csize && 0 != nc);
-
-    if (1 == nc || 1 == csize) {
-        /* duplicate */
-        tmp = _IO_PNG_SAFE_MALLOC(csize * nc, float);
-        memcpy(tmp, data, csize * nc * sizeof(float));
-        return tmp;
-    }
-
-    size = nc * csize;
-    tmp = _IO_PNG_SAFE_MALLOC(size, float);
-
-    switch (option) {
-    case INTERLACE:
-        for (i = 0; i < size; i++)
-            /*
-             * set the i-th element of tmp, interlaced
-             * its channel is i % nc
-             * its position in this channel is i / nc
-             */
-            tmp[i] = data[i % nc * csize + i / nc];
-        break;
-    case DEINTERLACE:
-        for (i = 0; i < size; i++)
-            /* reverse */
-            tmp[i % nc * csize + i / nc] = data[i];
-        break;
-    default:
-        _IO_PNG_ABORT("bad parameters");
-    }
-
-    return tmp;
-}
-
 /** type-generic any2flt array conversion code */
 #define _IO_PNG_ANY2FLT(MAX) do {                       \
         size_t i;                                       \
@@ -213,24 +184,71 @@ static float *_io_png_inter(const float *data, size_t csize, size_t nc,
     } while (0)
 
 /**
- * @brief convert png_byte array to float
+ * @brief convert a png_byte row into a deinterlaced float array
  *
- * @param png_data array to convert
- * @param size array size
- * @return converted array
+ * The row samples are converted with a lookup table and written to
+ * their channels, RGBA RGBA RGBA to RRR GGG BBB AAA.
  *
- * @todo use lookup table instead of division?
+ * @param data deinterlaced float array, row y updated
+ * @param row interlaced png_byte row
+ * @param lut png_byte to float conversion table, 256 values
+ * @param nx, ny, nc image size
+ * @param y row index
  */
-static float *_io_png_byte2flt(const png_byte * data, size_t size)
+static void _io_png_row2flt(float *data, const png_byte * row,
+                            const float *lut,
+                            size_t nx, size_t ny, size_t nc, size_t y)
 {
-    /* png_byte is 8bit data unsigned, [0..255] */
-    _IO_PNG_ANY2FLT(255);
+    size_t x, c;
+    float *out;
+
+    if (1 == nc) {
+        out = data + y * nx;
+        for (x = 0; x < nx; x++)
+            out[x] = lut[row[x]];
+        return;
+    }
+    for (c = 0; c < nc; c++) {
+        out = data + c * nx * ny + y * nx;
+        for (x = 0; x < nx; x++)
+            out[x] = lut[row[x * nc + c]];
+    }
+}
+
+/**
+ * @brief convert a 16bit png_byte row into a deinterlaced float array
+ *
+ * Same as _io_png_row2flt(), for 16bit samples. The PNG samples are
+ * big-endian whatever the host byte order, they are assembled from
+ * their two bytes and divided by 65535.
+ *
+ * @param data deinterlaced float array, row y updated
+ * @param row interlaced png_byte row, 2 bytes per sample
+ * @param nx, ny, nc image size
+ * @param y row index
+ */
+static void _io_png_row2flt16(float *data, const png_byte * row,
+                              size_t nx, size_t ny, size_t nc, size_t y)
+{
+    size_t x, c;
+    float *out;
+    const png_byte *in;
+
+    for (c = 0; c < nc; c++) {
+        out = data + c * nx * ny + y * nx;
+        in = row + 2 * c;
+        for (x = 0; x < nx; x++)
+            out[x] = (float) ((in[2 * x * nc] << 8) | in[2 * x * nc + 1])
+                / 65535.f;
+    }
 }
 
 /**
  * @brief convert unsigned char array to float
  *
- * See _io_png_byte2flt()
+ * @param data array to convert
+ * @param size array size
+ * @return converted array
  */
 static float *_io_png_uchar2flt(const unsigned char *data, size_t size)
 {
@@ -240,7 +258,7 @@ static float *_io_png_uchar2flt(const unsigned char *data, size_t size)
 /**
  * @brief convert unsigned short array to float
  *
- * See _io_png_byte2flt()
+ * See _io_png_uchar2flt()
  */
 static float *_io_png_ushrt2flt(const unsigned short *data, size_t size)
 {
@@ -264,38 +282,129 @@ static float *_io_png_ushrt2flt(const unsigned short *data, size_t size)
     } while (0)
 
 /**
- * @brief convert float array to png_byte
+ * @brief convert float array to unsigned char
  *
  * @param flt_data array to convert
  * @param size array size
  * @return converted array
+ */
+static unsigned char *_io_png_flt2uchar(const float *flt_data, size_t size)
+{
+    _IO_PNG_FLT2ANY(unsigned char, UCHAR_MAX);
+}
+
+/**
+ * @brief convert float array to unsigned short
  *
- * @todo bit twiddling instead of (?:) branching?
+ * See _io_png_flt2uchar()
  */
-static png_byte *_io_png_flt2byte(const float *flt_data, size_t size)
+static unsigned short *_io_png_flt2ushrt(const float *flt_data, size_t size)
 {
-    /* png_byte is 8bit data unsigned, [0..255] */
-    _IO_PNG_FLT2ANY(png_byte, 255);
+    _IO_PNG_FLT2ANY(unsigned short, USHRT_MAX);
 }
 
+/** @brief quantize a float to png_byte, as _io_png_flt2uchar() */
+#define _IO_PNG_FLT2BYTE(F, TMP)                                        \
+    ((TMP) = (F) * 255.f + .5f,                                         \
+     (png_byte) ((TMP) < 0.f ? 0.f : ((TMP) > 255.f ? 255.f : (TMP))))
+
 /**
- * @brief convert float array to unsigned char
+ * @brief convert a deinterlaced float array row into a png_byte row
+ *
+ * The samples are quantized as _io_png_flt2uchar() and interlaced,
+ * RRR GGG BBB AAA to RGBA RGBA RGBA. Each pixel is written once, with
+ * one specialized loop for 1, 2, 3 and 4 channels: the constant
+ * strides keep the stores in registers and the row in cache. The
+ * reverse conversion, _io_png_row2flt(), is faster one channel at a
+ * time, because its output rows are contiguous.
  *
- * See _io_png_flt2byte()
+ * @param row interlaced png_byte row, filled
+ * @param data deinterlaced float array
+ * @param nx, ny, nc image size
+ * @param y row index
  */
-static unsigned char *_io_png_flt2uchar(const float *flt_data, size_t size)
+static void _io_png_flt2row(png_byte * row, const float *data,
+                            size_t nx, size_t ny, size_t nc, size_t y)
 {
-    _IO_PNG_FLT2ANY(unsigned char, UCHAR_MAX);
+    const float *r, *g, *b, *a;
+    float t0, t1, t2, t3;
+    size_t x, c;
+
+    r = data + y * nx;
+    switch (nc) {
+    case 1:
+        for (x = 0; x < nx; x++)
+            row[x] = _IO_PNG_FLT2BYTE(r[x], t0);
+        break;
+    case 2:
+        g = r + nx * ny;
+        for (x = 0; x < nx; x++) {
+            row[2 * x] = _IO_PNG_FLT2BYTE(r[x], t0);
+            row[2 * x + 1] = _IO_PNG_FLT2BYTE(g[x], t1);
+        }
+        break;
+    case 3:
+        g = r + nx * ny;
+        b = g + nx * ny;
+        for (x = 0; x < nx; x++) {
+            row[3 * x] = _IO_PNG_FLT2BYTE(r[x], t0);
+            row[3 * x + 1] = _IO_PNG_FLT2BYTE(g[x], t1);
+            row[3 * x + 2] = _IO_PNG_FLT2BYTE(b[x], t2);
+        }
+        break;
+    case 4:
+        g = r + nx * ny;
+        b = g + nx * ny;
+        a = b + nx * ny;
+        for (x = 0; x < nx; x++) {
+            row[4 * x] = _IO_PNG_FLT2BYTE(r[x], t0);
+            row[4 * x + 1] = _IO_PNG_FLT2BYTE(g[x], t1);
+            row[4 * x + 2] = _IO_PNG_FLT2BYTE(b[x], t2);
+            row[4 * x + 3] = _IO_PNG_FLT2BYTE(a[x], t3);
+        }
+        break;
+    default:
+        for (c = 0; c < nc; c++) {
+            r = data + c * nx * ny + y * nx;
+            for (x = 0; x < nx; x++)
+                row[x * nc + c] = _IO_PNG_FLT2BYTE(r[x], t0);
+        }
+    }
 }
 
 /**
- * @brief convert float array to unsigned short
+ * @brief convert a deinterlaced float array row into a 16bit png_byte row
  *
- * See _io_png_flt2byte()
+ * Same as _io_png_flt2row(), for 16bit samples, quantized as
+ * _io_png_flt2ushrt() and stored big-endian, the PNG byte order,
+ * whatever the host byte order.
+ *
+ * @param row interlaced png_byte row, filled, 2 bytes per sample
+ * @param data deinterlaced float array
+ * @param nx, ny, nc image size
+ * @param y row index
  */
-static unsigned short *_io_png_flt2ushrt(const float *flt_data, size_t size)
+static void _io_png_flt2row16(png_byte * row, const float *data,
+                              size_t nx, size_t ny, size_t nc, size_t y)
 {
-    _IO_PNG_FLT2ANY(unsigned short, USHRT_MAX);
+    const float *in;
+    png_byte *out;
+    float tmp;
+    unsigned int val;
+    const float max = 65535.f;
+    size_t x, c;
+
+    for (c = 0; c < nc; c++) {
+        in = data + c * nx * ny + y * nx;
+        out = row + 2 * c;
+        for (x = 0; x < nx; x++) {
+            tmp = in[x] * max + .5f;
+            val = (unsigned int) (tmp < 0.f ? 0.f
+                                  : (tmp > max ? max : tmp));
+            out[2 * x * nc] = (png_byte) (val >> 8);
+            out[2 * x * nc + 1] = (png_byte) (val & 0xff);
+        }
+    }
 }
 
 /**
@@ -364,40 +473,45 @@ static float *_io_png_rgb2gray(float *data, size_t size)
 /**
  * @brief internal function used to read a PNG file into an array
  *
- * @param fname PNG file name, "-" means stdin
+ * @param fname PNG file name, "-" means stdin, NULL to use stream
+ * @param stream input stream, used if fname is NULL
  * @param nxp, nyp, ncp pointers to variables to be filled
  *        with the number of columns, lines and channels of the image
  * @param opt post-processing option, can be IO_PNG_OPT_RGB or IO_PNG_OPT_GRAY,
  *         IO_PNG_OPT_NONE to do nothing
- * @return pointer to an array of float pixels, abort() on error
+ * @param noabort return NULL instead of abort() on the errors of a
+ *        bad, truncated or too large PNG file
+ * @return pointer to an array of float pixels, abort() or NULL on error
  *
- * @todo don't loose 16bit info
  * @todo use enums?
  */
-static float *_io_png_read(const char *fname,
+static float *_io_png_read(const char *fname, FILE * stream,
                            size_t * nxp, size_t * nyp, size_t * ncp,
-                           io_png_opt_t opt)
+                           io_png_opt_t opt, int noabort)
 {
     png_byte png_sig[PNG_SIG_LEN];
     png_structp png_ptr;
     png_infop info_ptr;
-    png_bytepp row_pointers;
     size_t rowbytes;
-    png_byte *png_data;
-    float *data, *tmp;
-    int png_transform;
+    float lut[256];
+    int npass, depth;
     /* volatile: because of setjmp/longjmp */
     FILE *volatile fp = NULL;
+    float *volatile data = NULL;
+    png_byte *volatile png_data = NULL;
+    png_bytep *volatile row_pointers = NULL;
     size_t nx, ny, nc;
-    size_t size;
     size_t i;
     /* local error structure */
     _io_png_err_t err;
 
-    assert(NULL != fname && NULL != nxp && NULL != nyp && NULL != ncp);
+    assert((NULL != fname || NULL != stream)
+           && NULL != nxp && NULL != nyp && NULL != ncp);
 
     /* open the PNG input file */
-    if (0 == strcmp(fname, "-")) {
+    if (NULL == fname)
+        fp = stream;
+    else if (0 == strcmp(fname, "-")) {
         fp = stdin;
 #ifdef WIN32                    /* set the stream to binary mode */
         fflush(fp);
@@ -411,8 +525,13 @@ static float *_io_png_read(const char *fname,
 
     /* read in some of the signature bytes and check this signature */
     if ((PNG_SIG_LEN != fread(png_sig, 1, PNG_SIG_LEN, fp))
-        || 0 != png_sig_cmp(png_sig, (png_size_t) 0, PNG_SIG_LEN))
-        _IO_PNG_ABORT("the file is not a PNG image");
+        || 0 != png_sig_cmp(png_sig, (png_size_t) 0, PNG_SIG_LEN)) {
+        if (!noabort)
+            _IO_PNG_ABORT("the file is not a PNG image");
+        if (stdin != fp && stream != fp)
+            (void) fclose(fp);
+        return NULL;
+    }
 
     /*
      * create and initialize the png_struct and png_info structures
@@ -426,8 +545,17 @@ static float *_io_png_read(const char *fname,
         _IO_PNG_ABORT("libpng initialization error");
 
     /* if we get here, we had a problem reading from the file */
-    if (setjmp(err.jmpbuf))
-        _IO_PNG_ABORT("libpng reading error");
+    if (setjmp(err.jmpbuf)) {
+        if (!noabort)
+            _IO_PNG_ABORT("libpng reading error");
+        free(row_pointers);
+        free(png_data);
+        free(data);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        if (stdin != fp && stream != fp)
+            (void) fclose(fp);
+        return NULL;
+    }
 
     /* set up the input control using standard C streams */
     png_init_io(png_ptr, fp);
@@ -436,48 +564,73 @@ static float *_io_png_read(const char *fname,
     png_set_sig_bytes(png_ptr, PNG_SIG_LEN);
 
     /*
-     * set the read filter transforms, to get 8bit RGB whatever the
-     * original file may contain:
-     * PNG_TRANSFORM_PACKING       expand 1, 2 and 4-bit
-     *                             samples to bytes
-     * PNG_TRANSFORM_STRIP_16      chop 16-bit samples to
-     *                             8-bit
-     */
-    /* todo: handle 16bit? */
-    png_transform = (PNG_TRANSFORM_IDENTITY
-                     | PNG_TRANSFORM_PACKING | PNG_TRANSFORM_STRIP_16);
-
-    /*
-     * read in the entire image at once
-     * then collect the image informations
+     * set the read filter transforms, to get 8bit or 16bit samples
+     * whatever the original file may contain:
+     * png_set_packing()    expand 1, 2 and 4-bit samples to bytes
+     * then collect the image informations; the 16bit samples are
+     * kept, without precision loss
      */
-    png_read_png(png_ptr, info_ptr, png_transform, NULL);
+    png_read_info(png_ptr, info_ptr);
+    png_set_packing(png_ptr);
+    npass = png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
     nx = (size_t) png_get_image_width(png_ptr, info_ptr);
     ny = (size_t) png_get_image_height(png_ptr, info_ptr);
     nc = (size_t) png_get_channels(png_ptr, info_ptr);
-    size = nx * ny * nc;
-    row_pointers = png_get_rows(png_ptr, info_ptr);
     rowbytes = (size_t) png_get_rowbytes(png_ptr, info_ptr);
+    depth = (int) png_get_bit_depth(png_ptr, info_ptr);
 
-    /* dump the rows in a continuous array */
-    /* todo: first check if the data is continuous via row_pointers */
-    png_data = _IO_PNG_SAFE_MALLOC(size, png_byte);
-    for (i = 0; i < ny; i++)
-        memcpy((void *) (png_data + i * rowbytes),
-               (void *) row_pointers[i], rowbytes * sizeof(png_byte));
+    /* png_byte to float conversion table */
+    for (i = 0; i < 256; i++)
+        lut[i] = (float) i / (float) 255;
 
+    /*
+     * decode the rows one at a time, straight into the deinterlaced
+     * float array; the Adam7 interlaced images are decoded in several
+     * passes over the whole image, then converted
+     */
+    /* the array size must not overflow */
+    if ((size_t) -1 / sizeof(float) / nc / ny < nx)
+        png_error(png_ptr, "image too large");
+    data = (float *) _io_png_read_malloc(png_ptr, noabort,
+                                         nx * ny * nc * sizeof(float));
+    if (1 == npass) {
+        png_data = (png_byte *) _io_png_read_malloc(png_ptr, noabort,
+                                                    rowbytes);
+        for (i = 0; i < ny; i++) {
+            png_read_row(png_ptr, png_data, NULL);
+            if (16 == depth)
+                _io_png_row2flt16(data, png_data, nx, ny, nc, i);
+            else
+                _io_png_row2flt(data, png_data, lut, nx, ny, nc, i);
+        }
+    }
+    else {
+        png_data = (png_byte *) _io_png_read_malloc(png_ptr, noabort,
+                                                    ny * rowbytes);
+        row_pointers = (png_bytep *)
+            _io_png_read_malloc(png_ptr, noabort, ny * sizeof(png_bytep));
+        for (i = 0; i < ny; i++)
+            row_pointers[i] = png_data + i * rowbytes;
+        png_read_image(png_ptr, row_pointers);
+        for (i = 0; i < ny; i++) {
+            if (16 == depth)
+                _io_png_row2flt16(data, row_pointers[i], nx, ny, nc, i);
+            else
+                _io_png_row2flt(data, row_pointers[i], lut, nx, ny, nc, i);
+        }
+        free(row_pointers);
+        row_pointers = NULL;
+    }
+    free(png_data);
+    png_data = NULL;
+
+    /* read the end of the PNG data, until after the IEND chunk */
+    png_read_end(png_ptr, info_ptr);
     png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-    if (stdin != fp)
+    if (stdin != fp && stream != fp)
         (void) fclose(fp);
 
-    /* convert to float */
-    /* todo: at the row step */
-    tmp = _io_png_byte2flt(png_data, nx * ny * nc);
-    free(png_data);
-    /* deinterlace RGBA RGBA RGBA to RRR GGG BBB AAA */
-    data = _io_png_inter(tmp, nx * ny, nc, DEINTERLACE);
-    free(tmp);
-
     /* post-processing */
     switch (opt) {
     case IO_PNG_OPT_RGB:
@@ -521,7 +674,8 @@ static float *_io_png_read(const char *fname,
  * @brief read a PNG file into a float array with some options
  *
  * The image is read into an array with the deinterlaced channels,
- * with values in [0,1]. The option parameter is a string whose
+ * with values in [0,1], with the full precision of 8bit and 16bit
+ * images. The option parameter is a string whose
  * content defines the filters applied to the image data:
  * - "": do nothing
  * - "rgb": strip the alpha channel, convert gray images to rgb
@@ -543,7 +697,7 @@ float *io_png_read_flt_opt(const char *fname,
     if (NULL == fname)
         _IO_PNG_ABORT("bad parameters");
 
-    flt_data = _io_png_read(fname, &nx, &ny, &nc, opt);
+    flt_data = _io_png_read(fname, NULL, &nx, &ny, &nc, opt, 0);
 
     if (NULL != nxp)
         *nxp = nx;
@@ -571,6 +725,73 @@ float *io_png_read_flt(const char *fname,
     return io_png_read_flt_opt(fname, nxp, nyp, ncp, IO_PNG_OPT_NONE);
 }
 
+/**
+ * @brief read a PNG stream into a float array
+ *
+ * Same as io_png_read_flt(), from an open stream. The stream is left
+ * open, after the end of the PNG data.
+ *
+ * @param fp PNG input stream
+ * @param nxp, nyp, ncp pointers to variables to be filled with the number of
+ *        columns, lines and channels of the image, if not NULL
+ * @return pointer to an array of pixels, abort() on error
+ */
+float *io_png_read_flt_stream(FILE * fp,
+                              size_t * nxp, size_t * nyp, size_t * ncp)
+{
+    float *flt_data;
+    size_t nx, ny, nc;
+
+    if (NULL == fp)
+        _IO_PNG_ABORT("bad parameters");
+
+    flt_data = _io_png_read(NULL, fp, &nx, &ny, &nc, IO_PNG_OPT_NONE, 0);
+
+    if (NULL != nxp)
+        *nxp = nx;
+    if (NULL != nyp)
+        *nyp = ny;
+    if (NULL != ncp)
+        *ncp = nc;
+    return flt_data;
+}
+
+/**
+ * @brief read a PNG stream into a float array, without abort()
+ *
+ * Same as io_png_read_flt_stream(), for untrusted data: a stream that
+ * is not a PNG image, is truncated or corrupted, or is too large for
+ * the memory, is not fatal, the libpng error is printed on stderr and
+ * NULL is returned. The stream position is then undefined.
+ *
+ * @param fp PNG input stream
+ * @param nxp, nyp, ncp pointers to variables to be filled with the number of
+ *        columns, lines and channels of the image, if not NULL
+ * @return pointer to an array of pixels, NULL on error
+ */
+float *io_png_read_flt_stream_noabort(FILE * fp,
+                                      size_t * nxp, size_t * nyp,
+                                      size_t * ncp)
+{
+    float *flt_data;
+    size_t nx, ny, nc;
+
+    if (NULL == fp)
+        _IO_PNG_ABORT("bad parameters");
+
+    if (NULL == (flt_data = _io_png_read(NULL, fp, &nx, &ny, &nc,
+                                         IO_PNG_OPT_NONE, 1)))
+        return NULL;
+
+    if (NULL != nxp)
+        *nxp = nx;
+    if (NULL != nyp)
+        *nyp = ny;
+    if (NULL != ncp)
+        *ncp = nc;
+    return flt_data;
+}
+
 /**
  * @brief read a PNG file into an unsigned char array with some options
  *
@@ -589,7 +810,7 @@ unsigned char *io_png_read_uchar_opt(const char *fname,
     if (NULL == fname)
         _IO_PNG_ABORT("bad parameters");
 
-    flt_data = _io_png_read(fname, &nx, &ny, &nc, opt);
+    flt_data = _io_png_read(fname, NULL, &nx, &ny, &nc, opt, 0);
     data = _io_png_flt2uchar(flt_data, nx * ny * nc);
     free(flt_data);
 
@@ -637,7 +858,7 @@ unsigned short *io_png_read_ushrt_opt(const char *fname,
     if (NULL == fname)
         _IO_PNG_ABORT("bad parameters");
 
-    flt_data = _io_png_read(fname, &nx, &ny, &nc, opt);
+    flt_data = _io_png_read(fname, NULL, &nx, &ny, &nc, opt, 0);
     data = _io_png_flt2ushrt(flt_data, nx * ny * nc);
     free(flt_data);
 
@@ -671,49 +892,361 @@ unsigned short *io_png_read_ushrt(const char *fname,
  * WRITE
  */
 
+#ifdef _OPENMP
+
+/*
+ * PARALLEL WRITE
+ *
+ * Without interlacing, the PNG image data is one zlib stream of the
+ * filtered rows, split in any number of IDAT chunks. As pigz does,
+ * the rows are split in stripes, filtered and deflated in parallel:
+ * each stripe is an independent raw deflate sequence, primed with the
+ * previous 32K of filtered data as a preset dictionary, and ended by
+ * a sync flush on a byte boundary. The stripes are then written in
+ * order, one IDAT chunk each, between the zlib header and the
+ * combined adler32 checksum. The result is a standard PNG file.
+ */
+
+/** minimum image data size for the parallel encoder, in bytes */
+#define _IO_PNG_PAR_MIN_SIZE (1 << 20)
+
+/** target stripe size, in bytes */
+#define _IO_PNG_PAR_STRIPE_SIZE (256 << 10)
+
+/** deflate window, and preset dictionary size */
+#define _IO_PNG_PAR_WINDOW (1 << 15)
+
+/** @brief store a 32bit big-endian value */
+static void _io_png_put32(png_byte * buf, png_uint_32 val)
+{
+    buf[0] = (png_byte) (val >> 24);
+    buf[1] = (png_byte) (val >> 16);
+    buf[2] = (png_byte) (val >> 8);
+    buf[3] = (png_byte) val;
+}
+
+/**
+ * @brief write a PNG chunk
+ *
+ * @param fp output stream
+ * @param type chunk type, 4 characters
+ * @param data chunk data
+ * @param len chunk data size
+ */
+static void _io_png_chunk(FILE * fp, const char *type,
+                          const png_byte * data, size_t len)
+{
+    png_byte buf[8];
+    uLong crc;
+
+    _io_png_put32(buf, (png_uint_32) len);
+    memcpy(buf + 4, type, 4);
+    crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, buf + 4, 4);
+    if (0 < len)
+        crc = crc32(crc, data, (uInt) len);
+    if (1 != fwrite(buf, 8, 1, fp)
+        || (0 < len && 1 != fwrite(data, len, 1, fp)))
+        _IO_PNG_ABORT("failed to write file");
+    _io_png_put32(buf, (png_uint_32) crc);
+    if (1 != fwrite(buf, 4, 1, fp))
+        _IO_PNG_ABORT("failed to write file");
+}
+
+/** @brief PNG Paeth predictor */
+static png_byte _io_png_paeth(int a, int b, int c)
+{
+    int p, pa, pb, pc;
+
+    p = a + b - c;
+    pa = abs(p - a);
+    pb = abs(p - b);
+    pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return (png_byte) a;
+    if (pb <= pc)
+        return (png_byte) b;
+    return (png_byte) c;
+}
+
+/**
+ * @brief filter a row
+ *
+ * With the adaptive choice, as libpng, the five filters are tried and
+ * the one with the smallest sum of absolute (signed) values is kept;
+ * otherwise the SUB filter is used.
+ *
+ * @param out filtered row, filter type and rowbytes values
+ * @param row row
+ * @param prev previous row, zeros for the first row
+ * @param tmp work buffer, 5 * rowbytes
+ * @param rowbytes row size
+ * @param bpp bytes per pixel
+ * @param adaptive adaptive filter choice if not 0
+ */
+static void _io_png_filter_row(png_byte * out, const png_byte * row,
+                               const png_byte * prev, png_byte * tmp,
+                               size_t rowbytes, size_t bpp, int adaptive)
+{
+    png_byte *f;
+    size_t i, k, best;
+    unsigned long sum, best_sum;
+    int a, c;
+
+    /* SUB */
+    f = tmp + PNG_FILTER_VALUE_SUB * rowbytes - rowbytes;
+    for (i = 0; i < rowbytes; i++)
+        f[i] = (png_byte) (row[i] - (i < bpp ? 0 : row[i - bpp]));
+    if (!adaptive) {
+        out[0] = PNG_FILTER_VALUE_SUB;
+        memcpy(out + 1, f, rowbytes);
+        return;
+    }
+    /* UP, AVG, PAETH */
+    f = tmp + PNG_FILTER_VALUE_UP * rowbytes - rowbytes;
+    for (i = 0; i < rowbytes; i++)
+        f[i] = (png_byte) (row[i] - prev[i]);
+    f = tmp + PNG_FILTER_VALUE_AVG * rowbytes - rowbytes;
+    for (i = 0; i < rowbytes; i++) {
+        a = (i < bpp ? 0 : row[i - bpp]);
+        f[i] = (png_byte) (row[i] - ((a + prev[i]) >> 1));
+    }
+    f = tmp + PNG_FILTER_VALUE_PAETH * rowbytes - rowbytes;
+    for (i = 0; i < rowbytes; i++) {
+        a = (i < bpp ? 0 : row[i - bpp]);
+        c = (i < bpp ? 0 : prev[i - bpp]);
+        f[i] = (png_byte) (row[i] - _io_png_paeth(a, prev[i], c));
+    }
+
+    /* NONE, then the smallest sum */
+    best = PNG_FILTER_VALUE_NONE;
+    best_sum = 0;
+    for (i = 0; i < rowbytes; i++)
+        best_sum += (row[i] < 128 ? row[i] : 256 - row[i]);
+    for (k = PNG_FILTER_VALUE_SUB; k <= PNG_FILTER_VALUE_PAETH; k++) {
+        f = tmp + (k - 1) * rowbytes;
+        sum = 0;
+        for (i = 0; i < rowbytes; i++)
+            sum += (f[i] < 128 ? f[i] : 256 - f[i]);
+        if (sum < best_sum) {
+            best = k;
+            best_sum = sum;
+        }
+    }
+    out[0] = (png_byte) best;
+    memcpy(out + 1, (PNG_FILTER_VALUE_NONE == best ? row
+                     : tmp + (best - 1) * rowbytes), rowbytes);
+}
+
+/**
+ * @brief write a float array as a PNG file, with parallel compression
+ *
+ * See _io_png_write(), without interlacing. The compression level and
+ * filter choice follow the same options, but the compressed data, and
+ * the file, differ from the libpng output.
+ *
+ * @param fp output stream
+ * @param data non interlaced (RRRGGGBBBAAA) float image array
+ * @param nx, ny, nc number of columns, lines and channels
+ * @param opt processing option, see _io_png_write()
+ */
+static void _io_png_write_par(FILE * fp, const float *data,
+                              size_t nx, size_t ny, size_t nc,
+                              io_png_opt_t opt)
+{
+    png_byte hdr[13];
+    png_byte *filtered;         /* filtered rows */
+    png_byte **zbuf;            /* compressed stripes */
+    size_t *zlen;               /* compressed stripe sizes */
+    uLong *adler;               /* stripe checksums */
+    uLong check;
+    size_t rowbytes, bpp, srows, nstripes, s;
+    int level, strategy, adaptive, depth;
+    long k;
+    static const png_byte sig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    static const png_byte color_type[4] = {
+        PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA,
+        PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA
+    };
+
+    depth = (opt & IO_PNG_OPT_16BIT ? 16 : 8);
+    bpp = nc * (size_t) (depth / 8);
+    rowbytes = nx * bpp;
+    srows = _IO_PNG_PAR_STRIPE_SIZE / (rowbytes + 1);
+    srows = (0 == srows ? 1 : srows);
+    nstripes = (ny + srows - 1) / srows;
+
+    level = 5;
+    if (opt & IO_PNG_OPT_ZMIN)
+        level = 0;
+    if (opt & IO_PNG_OPT_ZMAX)
+        level = 9;
+    adaptive = !(opt & IO_PNG_OPT_ZFAST);
+    if (opt & IO_PNG_OPT_ZFAST)
+        level = 1;
+    strategy = (0 == level ? Z_DEFAULT_STRATEGY : Z_FILTERED);
+
+    filtered = _IO_PNG_SAFE_MALLOC(ny * (rowbytes + 1), png_byte);
+    zbuf = _IO_PNG_SAFE_MALLOC(nstripes, png_byte *);
+    zlen = _IO_PNG_SAFE_MALLOC(nstripes, size_t);
+    adler = _IO_PNG_SAFE_MALLOC(nstripes, uLong);
+
+    /* quantize and filter the stripes */
+#pragma omp parallel
+    {
+        png_byte *row, *prev, *swap, *tmp;
+        size_t y, y0, y1;
+
+        row = _IO_PNG_SAFE_MALLOC(rowbytes, png_byte);
+        prev = _IO_PNG_SAFE_MALLOC(rowbytes, png_byte);
+        tmp = _IO_PNG_SAFE_MALLOC(4 * rowbytes, png_byte);
+#pragma omp for schedule(dynamic, 1)
+        for (k = 0; k < (long) nstripes; k++) {
+            y0 = (size_t) k * srows;
+            y1 = (y0 + srows < ny ? y0 + srows : ny);
+            if (0 == y0)
+                memset(prev, 0, rowbytes);
+            else if (16 == depth)
+                _io_png_flt2row16(prev, data, nx, ny, nc, y0 - 1);
+            else
+                _io_png_flt2row(prev, data, nx, ny, nc, y0 - 1);
+            for (y = y0; y < y1; y++) {
+                if (16 == depth)
+                    _io_png_flt2row16(row, data, nx, ny, nc, y);
+                else
+                    _io_png_flt2row(row, data, nx, ny, nc, y);
+                _io_png_filter_row(filtered + y * (rowbytes + 1), row,
+                                   prev, tmp, rowbytes, bpp, adaptive);
+                swap = prev;
+                prev = row;
+                row = swap;
+            }
+        }
+        free(tmp);
+        free(prev);
+        free(row);
+    }
+
+    /* deflate the stripes, with the previous data as dictionary */
+#pragma omp parallel for schedule(dynamic, 1)
+    for (k = 0; k < (long) nstripes; k++) {
+        z_stream zs;
+        png_byte *in;
+        size_t in_len, dict_len, bound;
+        int last, status;
+
+        in = filtered + (size_t) k * srows * (rowbytes + 1);
+        in_len = ((size_t) k + 1 == nstripes ? ny - (size_t) k * srows
+                  : srows) * (rowbytes + 1);
+        last = ((size_t) k + 1 == nstripes);
+
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        if (Z_OK != deflateInit2(&zs, level, Z_DEFLATED,
+                                 -15, 8, strategy))
+            _IO_PNG_ABORT("zlib initialization error");
+        if (0 < k) {
+            dict_len = (size_t) (in - filtered);
+            dict_len = (dict_len < _IO_PNG_PAR_WINDOW ?
+                        dict_len : _IO_PNG_PAR_WINDOW);
+            (void) deflateSetDictionary(&zs, in - dict_len, (uInt) dict_len);
+        }
+        /* room for the zlib header, the sync flush and the checksum */
+        bound = (size_t) deflateBound(&zs, (uLong) in_len) + 16;
+        zbuf[k] = _IO_PNG_SAFE_MALLOC(bound, png_byte);
+        zs.next_in = in;
+        zs.avail_in = (uInt) in_len;
+        zs.next_out = zbuf[k] + 2;
+        zs.avail_out = (uInt) (bound - 6);
+        status = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        if ((last ? Z_STREAM_END : Z_OK) != status || 0 != zs.avail_in)
+            _IO_PNG_ABORT("zlib compression error");
+        zlen[k] = (size_t) (bound - 6 - zs.avail_out);
+        (void) deflateEnd(&zs);
+        adler[k] = adler32(adler32(0L, Z_NULL, 0), in, (uInt) in_len);
+    }
+
+    /* header and image data */
+    if (1 != fwrite(sig, 8, 1, fp))
+        _IO_PNG_ABORT("failed to write file");
+    _io_png_put32(hdr, (png_uint_32) nx);
+    _io_png_put32(hdr + 4, (png_uint_32) ny);
+    hdr[8] = (png_byte) depth;
+    hdr[9] = color_type[nc - 1];
+    hdr[10] = PNG_COMPRESSION_TYPE_BASE;
+    hdr[11] = PNG_FILTER_TYPE_BASE;
+    hdr[12] = PNG_INTERLACE_NONE;
+    _io_png_chunk(fp, "IHDR", hdr, 13);
+    check = adler[0];
+    for (s = 1; s < nstripes; s++)
+        check = adler32_combine(check, adler[s],
+                                (z_off_t) ((s + 1 == nstripes ?
+                                            ny - s * srows : srows)
+                                           * (rowbytes + 1)));
+    for (s = 0; s < nstripes; s++) {
+        if (0 == s) {
+            /* zlib header, 32K window, no dictionary */
+            zbuf[s][0] = 0x78;
+            zbuf[s][1] = 0x01;
+        }
+        if (s + 1 == nstripes) {
+            _io_png_put32(zbuf[s] + 2 + zlen[s], (png_uint_32) check);
+            zlen[s] += 4;
+        }
+        _io_png_chunk(fp, "IDAT", zbuf[s] + (0 == s ? 0 : 2),
+                      zlen[s] + (0 == s ? 2 : 0));
+        free(zbuf[s]);
+    }
+    _io_png_chunk(fp, "IEND", NULL, 0);
+
+    free(adler);
+    free(zlen);
+    free(zbuf);
+    free(filtered);
+}
+
+#endif                          /* _OPENMP */
+
 /**
  * @brief internal function used to write a byte array as a PNG file
  *
- * The PNG file is written as a 8bit image file, interlaced,
- * truecolor. Depending on the number of channels, the color model is
- * gray, gray+alpha, rgb, rgb+alpha.
+ * The PNG file is written as a 8bit image file, or 16bit with
+ * IO_PNG_OPT_16BIT, interlaced, truecolor. Depending on the number of
+ * channels, the color model is gray, gray+alpha, rgb, rgb+alpha.
  *
- * @param fname PNG file name, "-" means stdout
+ * @param fname PNG file name, "-" means stdout, NULL to use stream
+ * @param stream output stream, used if fname is NULL
  * @param data non interlaced (RRRGGGBBBAAA) float image array
  * @param nx, ny, nc number of columns, lines and channels
  * @param opt processing option, can be IO_PNG_OPT_ADAM7,
- *         IO_PNG_OPT_ZMIN or IO_PNG_OPT_ZMAX,
- *         IO_PNG_OPT_NONE to do nothing
+ *         IO_PNG_OPT_ZMIN, IO_PNG_OPT_ZMAX, IO_PNG_OPT_ZFAST or
+ *         IO_PNG_OPT_16BIT, IO_PNG_OPT_NONE to do nothing
  * @return void, abort() on error
- *
- * @todo handle 16bit
  */
-static void _io_png_write(const char *fname, const float *data,
+static void _io_png_write(const char *fname, FILE * stream,
+                          const float *data,
                           size_t nx, size_t ny, size_t nc, io_png_opt_t opt)
 {
     png_structp png_ptr;
     png_infop info_ptr;
-    png_bytep *row_pointers;
-    png_byte *png_data;
+    png_byte *png_row;
     png_byte bit_depth;
-    float *tmp;
     /* volatile: because of setjmp/longjmp */
     FILE *volatile fp;
     int color_type, interlace, compression, compression_level, filter;
+    int npass, pass;
     size_t i;
     /* error structure */
     _io_png_err_t err;
 
-    assert(NULL != fname && NULL != data && 0 < nx && 0 < ny && 0 < nc);
-
-    /* interlace RRR GGG BBB AAA to RGBA RGBA RGBA */
-    tmp = _io_png_inter(data, nx * ny, nc, INTERLACE);
-    /* convert to png_byte */
-    png_data = _io_png_flt2byte(tmp, nx * ny * nc);
-    free(tmp);
+    assert((NULL != fname || NULL != stream)
+           && NULL != data && 0 < nx && 0 < ny && 0 < nc);
 
     /* open the PNG output file */
-    if (0 == strcmp(fname, "-")) {
+    if (NULL == fname)
+        fp = stream;
+    else if (0 == strcmp(fname, "-")) {
         fp = stdout;
 #ifdef WIN32                    /* set the stream to binary mode */
         fflush(fp);
@@ -724,8 +1257,22 @@ static void _io_png_write(const char *fname, const float *data,
         if (NULL == (fp = fopen(fname, "wb")))
             _IO_PNG_ABORT("failed to open file");
     }
-    /* allocate the row pointers */
-    row_pointers = _IO_PNG_SAFE_MALLOC(ny, png_bytep);
+
+#ifdef _OPENMP
+    /* large images, outside of a parallel region */
+    if (!(opt & IO_PNG_OPT_ADAM7) && 4 >= nc
+        && _IO_PNG_PAR_MIN_SIZE <= nx * ny * nc
+        && 1 < omp_get_max_threads() && !omp_in_parallel()) {
+        _io_png_write_par(fp, data, nx, ny, nc, opt);
+        if (stdout != fp && stream != fp)
+            (void) fclose(fp);
+        return;
+    }
+#endif
+
+    /* allocate the row buffer, reused for every row */
+    bit_depth = (opt & IO_PNG_OPT_16BIT ? 16 : 8);
+    png_row = _IO_PNG_SAFE_MALLOC(nx * nc * (bit_depth / 8), png_byte);
 
     /*
      * create and initialize the png_struct and png_info structures
@@ -746,7 +1293,6 @@ static void _io_png_write(const char *fname, const float *data,
     png_init_io(png_ptr, fp);
 
     /* set image informations */
-    bit_depth = 8;
     switch (nc) {
     case 1:
         color_type = PNG_COLOR_TYPE_GRAY;
@@ -780,24 +1326,41 @@ static void _io_png_write(const char *fname, const float *data,
         compression_level = 0;
     if (opt & IO_PNG_OPT_ZMAX)
         compression_level = 9;
+    if (opt & IO_PNG_OPT_ZFAST) {
+        /*
+         * fast preset: a single SUB filter instead of the adaptive
+         * filter choice, and zlib level 1 with the strategy for
+         * filtered data; 2x faster than the default, 1.6x larger
+         * files on the retinex outputs of the data/ images
+         */
+        compression_level = 1;
+        png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+        png_set_compression_strategy(png_ptr, Z_FILTERED);
+    }
     png_set_compression_level(png_ptr, compression_level);
 
     /* TODO : significant bit (sBIT), gamma (gAMA) chunks */
     png_write_info(png_ptr, info_ptr);
 
-    /* set row pointers */
-    for (i = 0; i < ny; i++)
-        row_pointers[i] = (png_bytep) png_data + (size_t) (nc * nx * i);
-
-    /* write out the entire image and end it */
-    png_write_image(png_ptr, row_pointers);
+    /*
+     * quantize, interlace and write the rows one at a time; the Adam7
+     * passes each take the full rows
+     */
+    npass = png_set_interlace_handling(png_ptr);
+    for (pass = 0; pass < npass; pass++)
+        for (i = 0; i < ny; i++) {
+            if (16 == bit_depth)
+                _io_png_flt2row16(png_row, data, nx, ny, nc, i);
+            else
+                _io_png_flt2row(png_row, data, nx, ny, nc, i);
+            png_write_row(png_ptr, png_row);
+        }
     png_write_end(png_ptr, info_ptr);
 
     /* clean up and free any memory allocated, close the file */
     png_destroy_write_struct(&png_ptr, &info_ptr);
-    free(row_pointers);
-    free(png_data);
-    if (stdout != fp)
+    free(png_row);
+    if (stdout != fp && stream != fp)
         (void) fclose(fp);
 
     return;
@@ -807,22 +1370,20 @@ static void _io_png_write(const char *fname, const float *data,
  * @brief write a float array into a PNG file with some options
  *
  * The array values are taken from the [0,1] interval and converted to
- * 8bit data.
- *
- * @todo save as 16bit images
+ * 8bit data, or 16bit data with IO_PNG_OPT_16BIT.
  *
  * @param fname PNG file name
  * @param data deinterlaced (RRR.GGG.BBB.AAA.) array to write
  * @param nx, ny, nc number of columns, lines and channels of the image
  * @param opt processing option, can be IO_PNG_OPT_ADAM7,
- *         IO_PNG_OPT_ZMIN or IO_PNG_OPT_ZMAX,
- *         IO_PNG_OPT_NONE to do nothing
+ *         IO_PNG_OPT_ZMIN, IO_PNG_OPT_ZMAX, IO_PNG_OPT_ZFAST or
+ *         IO_PNG_OPT_16BIT, IO_PNG_OPT_NONE to do nothing
  * @return void, abort() on error
  */
 void io_png_write_flt_opt(const char *fname, const float *data,
                           size_t nx, size_t ny, size_t nc, io_png_opt_t opt)
 {
-    _io_png_write(fname, data, nx, ny, nc, opt);
+    _io_png_write(fname, NULL, data, nx, ny, nc, opt);
     return;
 }
 
@@ -843,6 +1404,45 @@ void io_png_write_flt(const char *fname, const float *data,
     return;
 }
 
+/**
+ * @brief write a float array into a PNG stream
+ *
+ * Same as io_png_write_flt(), to an open stream. The stream is left
+ * open.
+ *
+ * @param fp PNG output stream
+ * @param data deinterlaced (RRR.GGG.BBB.AAA.) array to write
+ * @param nx, ny, nc number of columns, lines and channels of the image
+ */
+void io_png_write_flt_stream(FILE * fp, const float *data,
+                             size_t nx, size_t ny, size_t nc)
+{
+    io_png_write_flt_stream_opt(fp, data, nx, ny, nc, IO_PNG_OPT_NONE);
+    return;
+}
+
+/**
+ * @brief write a float array into a PNG stream with some options
+ *
+ * Same as io_png_write_flt_opt(), to an open stream. The stream is
+ * left open.
+ *
+ * @param fp PNG output stream
+ * @param data deinterlaced (RRR.GGG.BBB.AAA.) array to write
+ * @param nx, ny, nc number of columns, lines and channels of the image
+ * @param opt processing option, see io_png_write_flt_opt()
+ */
+void io_png_write_flt_stream_opt(FILE * fp, const float *data,
+                                 size_t nx, size_t ny, size_t nc,
+                                 io_png_opt_t opt)
+{
+    if (NULL == fp)
+        _IO_PNG_ABORT("bad parameters");
+
+    _io_png_write(NULL, fp, data, nx, ny, nc, opt);
+    return;
+}
+
 /**
  * @brief write an unsigned char array into a 8bit PNG file
  *
@@ -856,7 +1456,7 @@ void io_png_write_uchar_opt(const char *fname, const unsigned char *data,
     float *flt_data;
 
     flt_data = _io_png_uchar2flt(data, nx * ny * nc);
-    _io_png_write(fname, flt_data, nx, ny, nc, opt);
+    _io_png_write(fname, NULL, flt_data, nx, ny, nc, opt);
     free(flt_data);
     return;
 }
@@ -881,10 +1481,10 @@ void io_png_write_uchar(const char *fname, const unsigned char *data,
 }
 
 /**
- * @brief write an unsigned short array into a 8bit PNG file
+ * @brief write an unsigned short array into a 16bit PNG file
  *
  * The array values are taken from the [0,USHRT_MAX] interval and
- * converted to float in the [0,1] interval before being saved as 8bit
+ * converted to float in the [0,1] interval before being saved as 16bit
  * fixed-point data. See io_png_write_flt_opt() for details.
  */
 void io_png_write_ushrt_opt(const char *fname, const unsigned short *data,
@@ -893,24 +1493,23 @@ void io_png_write_ushrt_opt(const char *fname, const unsigned short *data,
     float *flt_data;
 
     flt_data = _io_png_ushrt2flt(data, nx * ny * nc);
-    _io_png_write(fname, flt_data, nx, ny, nc, opt);
+    _io_png_write(fname, NULL, flt_data, nx, ny, nc,
+                  (io_png_opt_t) (opt | IO_PNG_OPT_16BIT));
     free(flt_data);
     return;
 }
 
 /**
- * @brief write an unsigned short array into a 8bit PNG file
+ * @brief write an unsigned short array into a 16bit PNG file
  *
  * The array values are taken from the [0,USHRT_MAX] interval and
- * converted to float in the [0,1] interval before being saved as 8bit
+ * converted to float in the [0,1] interval before being saved as 16bit
  * fixed-point data.
  *
  * @param fname PNG file name
  * @param data deinterlaced (RRR.GGG.BBB.AAA.) array to write
  * @param nx, ny, nc number of columns, lines and channels of the image
  * @return void, abort() on error
- *
- * @todo save in 16bits
  */
 void io_png_write_ushrt(const char *fname, const unsigned short *data,
                         size_t nx, size_t ny, size_t nc)
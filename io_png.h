@@ -8,6 +8,7 @@ extern "C" {
 #define IO_PNG_VERSION "0.20110919"
 
 #include <stddef.h>
+#include <stdio.h>
 
 typedef enum io_png_opt_e {
     IO_PNG_OPT_NONE = 0x00,
@@ -15,18 +16,25 @@ typedef enum io_png_opt_e {
     IO_PNG_OPT_GRAY = 0x02,
     IO_PNG_OPT_ADAM7 = 0x10,
     IO_PNG_OPT_ZMIN = 0x20,
-    IO_PNG_OPT_ZMAX = 0x40
+    IO_PNG_OPT_ZMAX = 0x40,
+    IO_PNG_OPT_ZFAST = 0x80,
+    IO_PNG_OPT_16BIT = 0x100
 } io_png_opt_t;
 
 /* io_png.c */
 char *io_png_info(void);
 float *io_png_read_flt_opt(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp, io_png_opt_t opt);
 float *io_png_read_flt(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp);
+float *io_png_read_flt_stream(FILE *fp, size_t *nxp, size_t *nyp, size_t *ncp);
+float *io_png_read_flt_stream_noabort(FILE *fp, size_t *nxp, size_t *nyp, size_t *ncp);
 unsigned char *io_png_read_uchar_opt(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp, io_png_opt_t opt);
 unsigned char *io_png_read_uchar(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp);
 unsigned short *io_png_read_ushrt_opt(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp, io_png_opt_t opt);
 unsigned short *io_png_read_ushrt(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp);
+void io_png_write_flt_opt(const char *fname, const float *data, size_t nx, size_t ny, size_t nc, io_png_opt_t opt);
 void io_png_write_flt(const char *fname, const float *data, size_t nx, size_t ny, size_t nc);
+void io_png_write_flt_stream(FILE *fp, const float *data, size_t nx, size_t ny, size_t nc);
+void io_png_write_flt_stream_opt(FILE *fp, const float *data, size_t nx, size_t ny, size_t nc, io_png_opt_t opt);
 void io_png_write_uchar(const char *fname, const unsigned char *data, size_t nx, size_t ny, size_t nc);
 void io_png_write_ushrt(const char *fname, const unsigned short *data, size_t nx, size_t ny, size_t nc);
 
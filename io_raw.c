@@ -0,0 +1,599 @@
+/*
+ * Copyright 2009-2011 IPOL Image Processing On Line http://www.ipol.im/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file io_raw.c
+ * @brief raw image read/write, without compression
+ *
+ * The samples are either float, with the same [0,1] range as the
+ * io_png float arrays and the native byte order, or 8bit, and they
+ * are stored planar (RRR GGG BBB) or interleaved (RGB RGB RGB), row
+ * by row.
+ *
+ * A raw file has either no header, and its size is known by the
+ * reader, or a header of IO_RAW_HEADER_SIZE bytes: the text
+ * "RAW type nx ny nc", padded with spaces and terminated by a
+ * newline, where type is f32, f32i, u8 or u8i.
+ *
+ * Regular files are mapped in memory. Planar float files are used in
+ * place: the image array is a private (copy-on-write) mapping of the
+ * file, and no read or conversion pass happens. The other layouts
+ * are converted from the mapping, or from the stream for stdin, one
+ * row at a time.
+ *
+ * Sequences of raw images, as the frames of a video, are read from
+ * and written to open streams, one image after the other.
+ */
+
+/* POSIX: mmap(), fileno() */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* unified Windows detection, see io_png.c */
+#if (defined(_WIN32) || defined(__WIN32__) \
+     || defined(__TOS_WIN__) || defined(__WINDOWS__))
+#ifndef WIN32
+#define WIN32
+#endif
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#if defined(_POSIX_MAPPED_FILES) && (_POSIX_MAPPED_FILES > 0)
+#define IO_RAW_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+#endif
+
+/* ensure consistency */
+#include "io_raw.h"
+
+/*
+ * UTILS
+ */
+
+/** @brief abort() wrapper macro with an error message */
+#define _IO_RAW_ABORT(MSG) do {                                 \
+    fprintf(stderr, "%s:%04u : %s\n", __FILE__, __LINE__, MSG); \
+    fflush(stderr);                                             \
+    abort();                                                    \
+    } while (0);
+
+/** @brief safe malloc wrapper */
+static void *_io_raw_safe_malloc(size_t size)
+{
+    void *memptr;
+
+    if (NULL == (memptr = malloc(size)))
+        _IO_RAW_ABORT("not enough memory");
+    return memptr;
+}
+
+/** @brief type names, in io_raw_type_t order */
+static const char *_io_raw_names[] = { "f32", "f32i", "u8", "u8i" };
+
+/** @brief sample size, in bytes */
+#define _IO_RAW_SAMPLE_SIZE(TYPE)                                       \
+    ((IO_RAW_F32 == (TYPE) || IO_RAW_F32I == (TYPE)) ? sizeof(float) : 1)
+
+/** @brief interleaved layout */
+#define _IO_RAW_INTERLEAVED(TYPE)                                       \
+    (IO_RAW_F32I == (TYPE) || IO_RAW_U8I == (TYPE))
+
+/**
+ * @brief get the raw type from its name
+ *
+ * @param name f32, f32i, u8 or u8i
+ * @param type pointer to the type, filled
+ *
+ * @return 0 on success, -1 for an unknown name
+ */
+int io_raw_type(const char *name, io_raw_type_t *type)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        if (0 == strcmp(name, _io_raw_names[i])) {
+            *type = (io_raw_type_t) i;
+            return 0;
+        }
+    return -1;
+}
+
+/**
+ * @brief check a raw image size
+ *
+ * The size must be positive, with 1 to 4 channels, and the float
+ * array size must not overflow.
+ *
+ * @return 0 for a valid size, -1 otherwise
+ */
+int io_raw_check_size(size_t nx, size_t ny, size_t nc)
+{
+    if (0 == nx || 0 == ny || 1 > nc || 4 < nc
+        || (size_t) -1 / sizeof(float) / nc / ny < nx)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief convert a file row into the planar float array
+ *
+ * The file has nc * ny rows of nx samples if planar, ny rows of
+ * nx * nc samples if interleaved.
+ *
+ * @param data planar float array, updated
+ * @param row file row
+ * @param r row index
+ */
+static void _io_raw_get_row(float *data, const unsigned char *row,
+                            io_raw_type_t type,
+                            size_t nx, size_t ny, size_t nc, size_t r)
+{
+    const float *frow = (const float *) row;
+    float *out;
+    size_t x, c;
+
+    switch (type) {
+    case IO_RAW_F32:
+        memcpy(data + r * nx, row, nx * sizeof(float));
+        break;
+    case IO_RAW_U8:
+        out = data + r * nx;
+        for (x = 0; x < nx; x++)
+            out[x] = (float) row[x] / (float) 255;
+        break;
+    case IO_RAW_F32I:
+        for (c = 0; c < nc; c++) {
+            out = data + c * nx * ny + r * nx;
+            for (x = 0; x < nx; x++)
+                out[x] = frow[x * nc + c];
+        }
+        break;
+    case IO_RAW_U8I:
+        for (c = 0; c < nc; c++) {
+            out = data + c * nx * ny + r * nx;
+            for (x = 0; x < nx; x++)
+                out[x] = (float) row[x * nc + c] / (float) 255;
+        }
+        break;
+    }
+}
+
+/** @brief quantize a float to 8bit, as io_png */
+#define _IO_RAW_FLT2U8(F, TMP)                                          \
+    ((TMP) = (F) * (float) 255 + .5,                                    \
+     (unsigned char) ((TMP) < 0. ? 0. : ((TMP) > 255. ? 255. : (TMP))))
+
+/**
+ * @brief convert the planar float array into a file row
+ *
+ * @see _io_raw_get_row()
+ */
+static void _io_raw_put_row(unsigned char *row, const float *data,
+                            io_raw_type_t type,
+                            size_t nx, size_t ny, size_t nc, size_t r)
+{
+    float *frow = (float *) row;
+    const float *in;
+    float tmp;
+    size_t x, c;
+
+    switch (type) {
+    case IO_RAW_F32:
+        memcpy(row, data + r * nx, nx * sizeof(float));
+        break;
+    case IO_RAW_U8:
+        in = data + r * nx;
+        for (x = 0; x < nx; x++)
+            row[x] = _IO_RAW_FLT2U8(in[x], tmp);
+        break;
+    case IO_RAW_F32I:
+        for (c = 0; c < nc; c++) {
+            in = data + c * nx * ny + r * nx;
+            for (x = 0; x < nx; x++)
+                frow[x * nc + c] = in[x];
+        }
+        break;
+    case IO_RAW_U8I:
+        for (c = 0; c < nc; c++) {
+            in = data + c * nx * ny + r * nx;
+            for (x = 0; x < nx; x++)
+                row[x * nc + c] = _IO_RAW_FLT2U8(in[x], tmp);
+        }
+        break;
+    }
+}
+
+/**
+ * @brief parse a raw file header
+ *
+ * @return 0 on success, -1 on error or for an invalid image size
+ */
+static int _io_raw_header(const unsigned char *hdr, io_raw_type_t *type,
+                          size_t *nxp, size_t *nyp, size_t *ncp)
+{
+    char str[IO_RAW_HEADER_SIZE + 1];
+    char name[8];
+    unsigned long nx, ny, nc;
+
+    memcpy(str, hdr, IO_RAW_HEADER_SIZE);
+    str[IO_RAW_HEADER_SIZE] = '\0';
+    if ('\n' != str[IO_RAW_HEADER_SIZE - 1]
+        || 4 != sscanf(str, "RAW %7s %lu %lu %lu", name, &nx, &ny, &nc)
+        || 0 != io_raw_type(name, type)
+        || 0 != io_raw_check_size((size_t) nx, (size_t) ny, (size_t) nc))
+        return -1;
+    *nxp = (size_t) nx;
+    *nyp = (size_t) ny;
+    *ncp = (size_t) nc;
+    return 0;
+}
+
+/**
+ * @brief write a raw file header
+ *
+ * @param hdr header, at least 2 * IO_RAW_HEADER_SIZE characters
+ */
+static void _io_raw_header_fill(char *hdr, io_raw_type_t type,
+                                size_t nx, size_t ny, size_t nc)
+{
+    int len;
+
+    /* at most 4 + 5 + 3 * 21 characters, with 64bit sizes */
+    len = sprintf(hdr, "RAW %s %lu %lu %lu", _io_raw_names[type],
+                  (unsigned long) nx, (unsigned long) ny,
+                  (unsigned long) nc);
+    if (IO_RAW_HEADER_SIZE - 1 < len)
+        _IO_RAW_ABORT("raw image too large for the header");
+    memset(hdr + len, ' ', IO_RAW_HEADER_SIZE - 1 - len);
+    hdr[IO_RAW_HEADER_SIZE - 1] = '\n';
+}
+
+/**
+ * @brief read a raw image
+ *
+ * If img->nx, img->ny and img->nc are 0, the file has a header, and
+ * the image size and type are read from it; otherwise, the file has
+ * no header, and they are the image size. Planar float regular files
+ * are mapped in memory and not copied; the image array can still be
+ * modified, without effect on the file.
+ *
+ * @param img raw image, with the size or 0, filled
+ * @param fname file name, "-" means stdin
+ * @param type sample layout, without header
+ *
+ * @return pointer to the planar float array, abort() on error
+ */
+float *io_raw_read(io_raw_t *img, const char *fname, io_raw_type_t type)
+{
+    FILE *fp;
+    size_t offset;
+#ifdef IO_RAW_MMAP
+    size_t row_size, nrow, r;
+    int fd;
+    struct stat st;
+    unsigned char *map;
+#endif
+
+    offset = (0 == img->nx && 0 == img->ny && 0 == img->nc ?
+              IO_RAW_HEADER_SIZE : 0);
+    img->map = NULL;
+    img->map_size = 0;
+
+#ifdef IO_RAW_MMAP
+    if (0 != strcmp(fname, "-")) {
+        if (-1 == (fd = open(fname, O_RDONLY)))
+            _IO_RAW_ABORT("failed to open file");
+        if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode)
+            || 0 == st.st_size)
+            _IO_RAW_ABORT("not a regular raw file");
+        map = (unsigned char *) mmap(NULL, (size_t) st.st_size,
+                                     PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                                     fd, 0);
+        (void) close(fd);
+        if (MAP_FAILED == (void *) map)
+            _IO_RAW_ABORT("failed to map file");
+        if (0 != offset
+            && ((size_t) st.st_size < offset
+                || 0 != _io_raw_header(map, &type,
+                                       &img->nx, &img->ny, &img->nc)))
+            _IO_RAW_ABORT("bad raw header");
+        if (0 != io_raw_check_size(img->nx, img->ny, img->nc))
+            _IO_RAW_ABORT("bad raw image size");
+        row_size = _IO_RAW_SAMPLE_SIZE(type) * img->nx
+            * (_IO_RAW_INTERLEAVED(type) ? img->nc : 1);
+        nrow = img->ny * (_IO_RAW_INTERLEAVED(type) ? 1 : img->nc);
+        if (((size_t) st.st_size - offset) / row_size < nrow)
+            _IO_RAW_ABORT("raw file too short");
+
+        if (IO_RAW_F32 == type) {
+            /* in place */
+            img->map = (void *) map;
+            img->map_size = (size_t) st.st_size;
+            img->data = (float *) (map + offset);
+        }
+        else {
+            img->data = (float *) _io_raw_safe_malloc(img->nx * img->ny
+                                                      * img->nc
+                                                      * sizeof(float));
+            for (r = 0; r < nrow; r++)
+                _io_raw_get_row(img->data, map + offset + r * row_size,
+                                type, img->nx, img->ny, img->nc, r);
+            (void) munmap((void *) map, (size_t) st.st_size);
+        }
+        return img->data;
+    }
+#endif
+
+    /* stream, converted row by row */
+    if (0 == strcmp(fname, "-")) {
+        fp = stdin;
+#ifdef WIN32                    /* set the stream to binary mode */
+        fflush(fp);
+        setmode(fileno(fp), O_BINARY);
+#endif
+    }
+    else if (NULL == (fp = fopen(fname, "rb")))
+        _IO_RAW_ABORT("failed to open file");
+
+    img->data = NULL;
+    if (NULL == io_raw_read_stream(img, fp, type, 0 != offset))
+        _IO_RAW_ABORT("raw file too short");
+    if (stdin != fp)
+        (void) fclose(fp);
+
+    return img->data;
+}
+
+/**
+ * @brief read a raw image from an open stream
+ *
+ * The stream is left open, after the image data, so a sequence of
+ * raw images, as the frames of a video, can be read one at a time.
+ * With a header, the image size and type are read from each image
+ * header; otherwise, img->nx, img->ny and img->nc are the image size.
+ *
+ * The image array, if not NULL, is reused: it must come from a
+ * previous io_raw_read_stream() call with this image, and is only
+ * reallocated if the image size changes. It is released by
+ * io_raw_free().
+ *
+ * @param img raw image, with the size without header, updated
+ * @param fp input stream
+ * @param type sample layout, without header
+ * @param header read a header if not 0
+ *
+ * @return pointer to the planar float array, NULL at the end of the
+ * stream, abort() on error
+ */
+float *io_raw_read_stream(io_raw_t *img, FILE *fp, io_raw_type_t type,
+                          int header)
+{
+    unsigned char hdr[IO_RAW_HEADER_SIZE];
+    unsigned char *row;
+    size_t size, row_size, nrow, r;
+    int c;
+
+    /* nothing left, a normal end of stream */
+    if (EOF == (c = getc(fp)))
+        return NULL;
+    (void) ungetc(c, fp);
+
+    size = (NULL == img->data ? 0 : img->nx * img->ny * img->nc);
+    img->map = NULL;
+    img->map_size = 0;
+    if (header
+        && (1 != fread(hdr, IO_RAW_HEADER_SIZE, 1, fp)
+            || 0 != _io_raw_header(hdr, &type,
+                                   &img->nx, &img->ny, &img->nc)))
+        _IO_RAW_ABORT("bad raw header");
+    if (0 != io_raw_check_size(img->nx, img->ny, img->nc))
+        _IO_RAW_ABORT("bad raw image size");
+    row_size = _IO_RAW_SAMPLE_SIZE(type) * img->nx
+        * (_IO_RAW_INTERLEAVED(type) ? img->nc : 1);
+    nrow = img->ny * (_IO_RAW_INTERLEAVED(type) ? 1 : img->nc);
+
+    if (img->nx * img->ny * img->nc != size) {
+        free(img->data);
+        img->data = (float *) _io_raw_safe_malloc(img->nx * img->ny
+                                                  * img->nc
+                                                  * sizeof(float));
+    }
+    if (IO_RAW_F32 == type) {
+        /* read in place */
+        if (nrow != fread(img->data, row_size, nrow, fp))
+            _IO_RAW_ABORT("raw file too short");
+    }
+    else {
+        row = (unsigned char *) _io_raw_safe_malloc(row_size);
+        for (r = 0; r < nrow; r++) {
+            if (1 != fread(row, row_size, 1, fp))
+                _IO_RAW_ABORT("raw file too short");
+            _io_raw_get_row(img->data, row, type,
+                            img->nx, img->ny, img->nc, r);
+        }
+        free(row);
+    }
+
+    return img->data;
+}
+
+/**
+ * @brief create a planar float raw file, mapped in memory
+ *
+ * The file is written by the system as the array is modified, and
+ * completed by io_raw_free(), so an image larger than the memory can
+ * be written piecewise. This needs memory mapping support, and a
+ * regular file.
+ *
+ * @param img raw image, filled
+ * @param fname file name
+ * @param nx, ny, nc image size
+ * @param header write a header if not 0
+ *
+ * @return pointer to the planar float array, abort() on error
+ */
+float *io_raw_create(io_raw_t *img, const char *fname,
+                     size_t nx, size_t ny, size_t nc, int header)
+{
+#ifdef IO_RAW_MMAP
+    char hdr[2 * IO_RAW_HEADER_SIZE];
+    size_t offset;
+    unsigned char *map;
+    int fd;
+
+    offset = (header ? IO_RAW_HEADER_SIZE : 0);
+    img->nx = nx;
+    img->ny = ny;
+    img->nc = nc;
+    img->map_size = offset + nx * ny * nc * sizeof(float);
+
+    if (0 == strcmp(fname, "-")
+        || -1 == (fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0666)))
+        _IO_RAW_ABORT("failed to open file");
+    if (0 != ftruncate(fd, (off_t) img->map_size))
+        _IO_RAW_ABORT("failed to write file");
+    map = (unsigned char *) mmap(NULL, img->map_size,
+                                 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    (void) close(fd);
+    if (MAP_FAILED == (void *) map)
+        _IO_RAW_ABORT("failed to map file");
+
+    if (header) {
+        _io_raw_header_fill(hdr, IO_RAW_F32, nx, ny, nc);
+        memcpy(map, hdr, IO_RAW_HEADER_SIZE);
+    }
+    img->map = (void *) map;
+    img->data = (float *) (map + offset);
+
+    return img->data;
+#else
+    (void) img;
+    (void) fname;
+    (void) nx;
+    (void) ny;
+    (void) nc;
+    (void) header;
+    _IO_RAW_ABORT("raw file mapping is not supported");
+    return NULL;
+#endif
+}
+
+/**
+ * @brief release a raw image read by io_raw_read() or created by
+ * io_raw_create()
+ */
+void io_raw_free(io_raw_t *img)
+{
+#ifdef IO_RAW_MMAP
+    if (NULL != img->map) {
+        (void) munmap(img->map, img->map_size);
+        img->map = NULL;
+        img->data = NULL;
+        return;
+    }
+#endif
+    free(img->data);
+    img->data = NULL;
+}
+
+/**
+ * @brief write a planar float array to a raw file
+ *
+ * Planar float arrays are written as they are, the other layouts are
+ * converted one row at a time.
+ *
+ * @param fname file name, "-" means stdout
+ * @param data planar float array
+ * @param nx, ny, nc image size
+ * @param type sample layout
+ * @param header write a header if not 0
+ */
+void io_raw_write(const char *fname, const float *data,
+                  size_t nx, size_t ny, size_t nc,
+                  io_raw_type_t type, int header)
+{
+    FILE *fp;
+
+    if (0 == strcmp(fname, "-")) {
+        fp = stdout;
+#ifdef WIN32                    /* set the stream to binary mode */
+        fflush(fp);
+        setmode(fileno(fp), O_BINARY);
+#endif
+    }
+    else if (NULL == (fp = fopen(fname, "wb")))
+        _IO_RAW_ABORT("failed to open file");
+
+    io_raw_write_stream(fp, data, nx, ny, nc, type, header);
+
+    if (stdout == fp)
+        (void) fflush(fp);
+    else if (0 != fclose(fp))
+        _IO_RAW_ABORT("failed to write file");
+}
+
+/**
+ * @brief write a planar float array to an open stream
+ *
+ * Same as io_raw_write(), the stream is left open, after the image
+ * data, and not flushed.
+ *
+ * @param fp output stream
+ * @param data planar float array
+ * @param nx, ny, nc image size
+ * @param type sample layout
+ * @param header write a header if not 0
+ */
+void io_raw_write_stream(FILE *fp, const float *data,
+                         size_t nx, size_t ny, size_t nc,
+                         io_raw_type_t type, int header)
+{
+    char hdr[2 * IO_RAW_HEADER_SIZE];
+    unsigned char *row;
+    size_t row_size, nrow, r;
+
+    if (header) {
+        _io_raw_header_fill(hdr, type, nx, ny, nc);
+        if (1 != fwrite(hdr, IO_RAW_HEADER_SIZE, 1, fp))
+            _IO_RAW_ABORT("failed to write file");
+    }
+
+    row_size = _IO_RAW_SAMPLE_SIZE(type) * nx
+        * (_IO_RAW_INTERLEAVED(type) ? nc : 1);
+    nrow = ny * (_IO_RAW_INTERLEAVED(type) ? 1 : nc);
+    if (IO_RAW_F32 == type) {
+        if (nrow != fwrite(data, row_size, nrow, fp))
+            _IO_RAW_ABORT("failed to write file");
+    }
+    else {
+        row = (unsigned char *) _io_raw_safe_malloc(row_size);
+        for (r = 0; r < nrow; r++) {
+            _io_raw_put_row(row, data, type, nx, ny, nc, r);
+            if (1 != fwrite(row, row_size, 1, fp))
+                _IO_RAW_ABORT("failed to write file");
+        }
+        free(row);
+    }
+}
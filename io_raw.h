@@ -0,0 +1,44 @@
+#ifndef _IO_RAW_H
+#define _IO_RAW_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+
+/** size of the optional raw file header, in bytes */
+#define IO_RAW_HEADER_SIZE 64
+
+/** raw sample layouts */
+typedef enum io_raw_type_e {
+    IO_RAW_F32 = 0,             /**< float, planar (RRR GGG BBB) */
+    IO_RAW_F32I = 1,            /**< float, interleaved (RGB RGB RGB) */
+    IO_RAW_U8 = 2,              /**< 8bit, planar */
+    IO_RAW_U8I = 3              /**< 8bit, interleaved */
+} io_raw_type_t;
+
+/** raw image, read by io_raw_read() and released by io_raw_free() */
+typedef struct io_raw_s {
+    float *data;                /**< planar float array */
+    size_t nx, ny, nc;          /**< image size */
+    void *map;                  /**< file mapping, NULL if allocated */
+    size_t map_size;            /**< file mapping size */
+} io_raw_t;
+
+/* io_raw.c */
+int io_raw_type(const char *name, io_raw_type_t *type);
+int io_raw_check_size(size_t nx, size_t ny, size_t nc);
+float *io_raw_read(io_raw_t *img, const char *fname, io_raw_type_t type);
+float *io_raw_read_stream(io_raw_t *img, FILE *fp, io_raw_type_t type, int header);
+float *io_raw_create(io_raw_t *img, const char *fname, size_t nx, size_t ny, size_t nc, int header);
+void io_raw_free(io_raw_t *img);
+void io_raw_write(const char *fname, const float *data, size_t nx, size_t ny, size_t nc, io_raw_type_t type, int header);
+void io_raw_write_stream(FILE *fp, const float *data, size_t nx, size_t ny, size_t nc, io_raw_type_t type, int header);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_IO_RAW_H */
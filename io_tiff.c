@@ -0,0 +1,554 @@
+/*
+ * Copyright 2009-2011 IPOL Image Processing On Line http://www.ipol.im/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file io_tiff.c
+ * @brief uncompressed float TIFF image read/write
+ *
+ * Only the TIFF files with uncompressed 32bit IEEE float samples
+ * (SampleFormat 3, BitsPerSample 32, Compression 1) are supported,
+ * in either byte order, with 1 to 4 samples per pixel, any number of
+ * rows per strip, interleaved (PlanarConfiguration 1) or planar
+ * (PlanarConfiguration 2). Only the first image of a file is read.
+ *
+ * The samples are read into, and written from, planar float arrays
+ * (RRR GGG BBB), as io_png.c, one row at a time, without clamping nor
+ * quantization, so high dynamic range values are kept. The files are
+ * written in the native byte order, interleaved, as a single strip,
+ * gray (1 or 2 channels) or RGB (3 or 4 channels), the second or
+ * fourth channel being an unassociated alpha channel. The header is
+ * written first, so a TIFF file can be written to a stream; it is
+ * read from a seekable file, and stdin is first copied to a
+ * temporary file.
+ *
+ * This is not a general TIFF library, use libtiff for the other
+ * sample formats and compressions.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* unified Windows detection, see io_png.c */
+#if (defined(_WIN32) || defined(__WIN32__) \
+     || defined(__TOS_WIN__) || defined(__WINDOWS__))
+#ifndef WIN32
+#define WIN32
+#endif
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+/* ensure consistency */
+#include "io_tiff.h"
+
+/*
+ * UTILS
+ */
+
+/** @brief abort() wrapper macro with an error message */
+#define _IO_TIFF_ABORT(MSG) do {                                \
+    fprintf(stderr, "%s:%04u : %s\n", __FILE__, __LINE__, MSG); \
+    fflush(stderr);                                             \
+    abort();                                                    \
+    } while (0);
+
+/** TIFF tags, field types and values */
+#define _IO_TIFF_WIDTH 256
+#define _IO_TIFF_LENGTH 257
+#define _IO_TIFF_BITS 258
+#define _IO_TIFF_COMPRESSION 259
+#define _IO_TIFF_PHOTOMETRIC 262
+#define _IO_TIFF_STRIP_OFFSETS 273
+#define _IO_TIFF_SAMPLES 277
+#define _IO_TIFF_ROWS_PER_STRIP 278
+#define _IO_TIFF_STRIP_BYTES 279
+#define _IO_TIFF_PLANAR 284
+#define _IO_TIFF_EXTRA_SAMPLES 338
+#define _IO_TIFF_SAMPLE_FORMAT 339
+#define _IO_TIFF_SHORT 3
+#define _IO_TIFF_LONG 4
+#define _IO_TIFF_IEEEFP 3
+
+/** @brief safe malloc wrapper */
+static void *_io_tiff_safe_malloc(size_t size)
+{
+    void *memptr;
+
+    if (NULL == (memptr = malloc(size)))
+        _IO_TIFF_ABORT("not enough memory");
+    return memptr;
+}
+
+/** @brief 1 on a big-endian host, 0 on a little-endian host */
+static int _io_tiff_big_endian(void)
+{
+    unsigned int one = 1;
+
+    return (1 != *(unsigned char *) &one);
+}
+
+/** @brief reverse the byte order of n 32bit floats */
+static void _io_tiff_swap(float *row, size_t n)
+{
+    unsigned char *ptr, tmp;
+    size_t i;
+
+    ptr = (unsigned char *) row;
+    for (i = 0; i < n; i++, ptr += 4) {
+        tmp = ptr[0];
+        ptr[0] = ptr[3];
+        ptr[3] = tmp;
+        tmp = ptr[1];
+        ptr[1] = ptr[2];
+        ptr[2] = tmp;
+    }
+}
+
+/** @brief decode a 16bit (size 2) or 32bit (size 4) integer */
+static unsigned long _io_tiff_get(const unsigned char *ptr, int size,
+                                  int big)
+{
+    unsigned long val = 0;
+    int i;
+
+    for (i = 0; i < size; i++)
+        val |= (unsigned long) ptr[big ? i : size - 1 - i]
+            << (8 * (size - 1 - i));
+    return val;
+}
+
+/** @brief encode a 16bit (size 2) or 32bit (size 4) integer */
+static void _io_tiff_put(unsigned char *ptr, unsigned long val, int size,
+                         int big)
+{
+    int i;
+
+    for (i = 0; i < size; i++)
+        ptr[big ? i : size - 1 - i] =
+            (unsigned char) ((val >> (8 * (size - 1 - i))) & 0xff);
+}
+
+/*
+ * READ
+ */
+
+/**
+ * @brief read the values of an IFD entry
+ *
+ * @param fp input file
+ * @param ent 12 bytes IFD entry
+ * @param big big-endian file
+ * @param countp pointer to the number of values, filled
+ *
+ * @return allocated array of values, abort() on error
+ */
+static unsigned long *_io_tiff_values(FILE *fp, const unsigned char *ent,
+                                      int big, size_t *countp)
+{
+    unsigned long type, *val;
+    unsigned char *buf;
+    const unsigned char *ptr;
+    size_t count, i;
+    int size;
+
+    type = _io_tiff_get(ent + 2, 2, big);
+    count = (size_t) _io_tiff_get(ent + 4, 4, big);
+    if (_IO_TIFF_SHORT == type)
+        size = 2;
+    else if (_IO_TIFF_LONG == type)
+        size = 4;
+    else
+        _IO_TIFF_ABORT("unsupported TIFF field type");
+    if (0 == count)
+        _IO_TIFF_ABORT("bad TIFF field");
+
+    buf = NULL;
+    if (4 >= count * size)
+        ptr = ent + 8;
+    else {
+        buf = (unsigned char *) _io_tiff_safe_malloc(count * size);
+        if (0 != fseek(fp, (long) _io_tiff_get(ent + 8, 4, big), SEEK_SET)
+            || 1 != fread(buf, count * size, 1, fp))
+            _IO_TIFF_ABORT("TIFF file too short");
+        ptr = buf;
+    }
+    val = (unsigned long *) _io_tiff_safe_malloc(count
+                                                 * sizeof(unsigned long));
+    for (i = 0; i < count; i++)
+        val[i] = _io_tiff_get(ptr + i * size, size, big);
+    free(buf);
+
+    *countp = count;
+    return val;
+}
+
+/**
+ * @brief read the single value of an IFD entry
+ */
+static unsigned long _io_tiff_value(FILE *fp, const unsigned char *ent,
+                                    int big)
+{
+    unsigned long *val, v;
+    size_t count;
+
+    val = _io_tiff_values(fp, ent, big, &count);
+    v = val[0];
+    free(val);
+    return v;
+}
+
+/**
+ * @brief read a float TIFF image from a seekable stream
+ *
+ * @param fp input stream, seekable
+ * @param nxp, nyp, ncp pointers to the image size, filled
+ *
+ * @return pointer to an allocated planar float array, abort() on error
+ */
+float *io_tiff_read_stream(FILE *fp, size_t *nxp, size_t *nyp, size_t *ncp)
+{
+    unsigned char hdr[8], *ifd;
+    unsigned long *offsets, *val;
+    size_t nx, ny, nc, rps, planar, nent, noff, nstrip, spp;
+    size_t s, r, y, x, c, n, i;
+    float *data, *row, *ptr;
+    unsigned long bits;
+    int big, swap, ieee;
+
+    if (1 != fread(hdr, 8, 1, fp)
+        || !(('I' == hdr[0] && 'I' == hdr[1])
+             || ('M' == hdr[0] && 'M' == hdr[1])))
+        _IO_TIFF_ABORT("bad TIFF header");
+    big = ('M' == hdr[0]);
+    if (42 != _io_tiff_get(hdr + 2, 2, big)
+        || 0 != fseek(fp, (long) _io_tiff_get(hdr + 4, 4, big), SEEK_SET)
+        || 1 != fread(hdr, 2, 1, fp))
+        _IO_TIFF_ABORT("bad TIFF header");
+
+    /* first IFD */
+    nent = (size_t) _io_tiff_get(hdr, 2, big);
+    ifd = (unsigned char *) _io_tiff_safe_malloc(12 * nent + 1);
+    if (0 < nent && 1 != fread(ifd, 12 * nent, 1, fp))
+        _IO_TIFF_ABORT("TIFF file too short");
+    nx = ny = 0;
+    nc = 1;
+    rps = 0;
+    planar = 1;
+    bits = 1;
+    ieee = 0;
+    offsets = NULL;
+    noff = 0;
+    for (i = 0; i < nent; i++) {
+        switch (_io_tiff_get(ifd + 12 * i, 2, big)) {
+        case _IO_TIFF_WIDTH:
+            nx = (size_t) _io_tiff_value(fp, ifd + 12 * i, big);
+            break;
+        case _IO_TIFF_LENGTH:
+            ny = (size_t) _io_tiff_value(fp, ifd + 12 * i, big);
+            break;
+        case _IO_TIFF_SAMPLES:
+            nc = (size_t) _io_tiff_value(fp, ifd + 12 * i, big);
+            break;
+        case _IO_TIFF_ROWS_PER_STRIP:
+            rps = (size_t) _io_tiff_value(fp, ifd + 12 * i, big);
+            break;
+        case _IO_TIFF_PLANAR:
+            planar = (size_t) _io_tiff_value(fp, ifd + 12 * i, big);
+            break;
+        case _IO_TIFF_COMPRESSION:
+            if (1 != _io_tiff_value(fp, ifd + 12 * i, big))
+                _IO_TIFF_ABORT("compressed TIFF files are not supported");
+            break;
+        case _IO_TIFF_BITS:
+            /* every sample must be 32bit */
+            val = _io_tiff_values(fp, ifd + 12 * i, big, &n);
+            for (bits = 32; n-- > 0;)
+                bits = (32 == val[n] ? bits : 0);
+            free(val);
+            break;
+        case _IO_TIFF_SAMPLE_FORMAT:
+            /* every sample must be a float */
+            val = _io_tiff_values(fp, ifd + 12 * i, big, &n);
+            for (ieee = 1; n-- > 0;)
+                ieee = (_IO_TIFF_IEEEFP == val[n] ? ieee : 0);
+            free(val);
+            break;
+        case _IO_TIFF_STRIP_OFFSETS:
+            if (NULL != offsets)
+                _IO_TIFF_ABORT("bad TIFF strips");
+            offsets = _io_tiff_values(fp, ifd + 12 * i, big, &noff);
+            break;
+        default:
+            break;
+        }
+    }
+    free(ifd);
+    /* the float array size must not overflow */
+    if (0 == nx || 0 == ny || 1 > nc || 4 < nc || NULL == offsets
+        || (1 != planar && 2 != planar)
+        || (size_t) -1 / sizeof(float) / nc / ny < nx)
+        _IO_TIFF_ABORT("bad TIFF image");
+    /* the defaults are 1bit unsigned integer samples */
+    if (32 != bits || !ieee)
+        _IO_TIFF_ABORT("only 32bit float TIFF files are supported");
+    if (0 == rps || rps > ny)
+        rps = ny;
+    spp = (ny + rps - 1) / rps;
+    nstrip = (2 == planar ? nc * spp : spp);
+    if (noff < nstrip)
+        _IO_TIFF_ABORT("bad TIFF strips");
+    swap = (big != _io_tiff_big_endian());
+
+    data = (float *) _io_tiff_safe_malloc(nx * ny * nc * sizeof(float));
+    n = (2 == planar ? nx : nx * nc);
+    row = (float *) _io_tiff_safe_malloc(n * sizeof(float));
+    for (s = 0; s < nstrip; s++) {
+        if (0 != fseek(fp, (long) offsets[s], SEEK_SET))
+            _IO_TIFF_ABORT("TIFF file too short");
+        for (r = 0; r < rps; r++) {
+            y = (s % spp) * rps + r;
+            if (y >= ny)
+                break;
+            if (n != fread(row, sizeof(float), n, fp))
+                _IO_TIFF_ABORT("TIFF file too short");
+            if (swap)
+                _io_tiff_swap(row, n);
+            if (2 == planar)
+                memcpy(data + ((s / spp) * ny + y) * nx, row,
+                       nx * sizeof(float));
+            else
+                for (c = 0; c < nc; c++) {
+                    ptr = data + (c * ny + y) * nx;
+                    for (x = 0; x < nx; x++)
+                        ptr[x] = row[x * nc + c];
+                }
+        }
+    }
+    free(row);
+    free(offsets);
+
+    *nxp = nx;
+    *nyp = ny;
+    *ncp = nc;
+    return data;
+}
+
+/**
+ * @brief read a float TIFF image file into a planar float array
+ *
+ * @param fname file name, "-" means stdin
+ * @param nxp, nyp, ncp pointers to the image size, filled
+ *
+ * @return pointer to an allocated planar float array, abort() on error
+ */
+float *io_tiff_read(const char *fname, size_t *nxp, size_t *nyp,
+                    size_t *ncp)
+{
+    FILE *fp;
+    float *data;
+    char buf[4096];
+    size_t len;
+
+    if (0 == strcmp(fname, "-")) {
+#ifdef WIN32                    /* set the stream to binary mode */
+        setmode(fileno(stdin), O_BINARY);
+#endif
+        /* the strips are read in any order, copy stdin */
+        if (NULL == (fp = tmpfile()))
+            _IO_TIFF_ABORT("failed to create a temporary file");
+        while (0 < (len = fread(buf, 1, sizeof(buf), stdin)))
+            if (len != fwrite(buf, 1, len, fp))
+                _IO_TIFF_ABORT("failed to write the temporary file");
+        rewind(fp);
+    }
+    else if (NULL == (fp = fopen(fname, "rb")))
+        _IO_TIFF_ABORT("failed to open file");
+
+    data = io_tiff_read_stream(fp, nxp, nyp, ncp);
+
+    (void) fclose(fp);
+    return data;
+}
+
+/*
+ * WRITE
+ */
+
+/**
+ * @brief fill an IFD entry
+ *
+ * The values are stored in the entry if they fit in 4 bytes, and at
+ * the offset off of the header buffer hdr otherwise.
+ *
+ * @param val values, or NULL to repeat the single value v
+ */
+static void _io_tiff_entry(unsigned char *hdr, unsigned char *ent,
+                           unsigned tag, unsigned type, size_t count,
+                           const unsigned *val, unsigned long v,
+                           size_t off, int big)
+{
+    int size = (_IO_TIFF_SHORT == type ? 2 : 4);
+    unsigned char *ptr;
+    size_t i;
+
+    _io_tiff_put(ent, tag, 2, big);
+    _io_tiff_put(ent + 2, type, 2, big);
+    _io_tiff_put(ent + 4, (unsigned long) count, 4, big);
+    memset(ent + 8, 0, 4);
+    if (4 >= count * size)
+        ptr = ent + 8;
+    else {
+        _io_tiff_put(ent + 8, (unsigned long) off, 4, big);
+        ptr = hdr + off;
+    }
+    for (i = 0; i < count; i++)
+        _io_tiff_put(ptr + i * size, (NULL == val ? v : val[i]), size,
+                     big);
+}
+
+/**
+ * @brief write a planar float array to an open stream, as TIFF
+ *
+ * Same as io_tiff_write(), the stream is left open, after the image
+ * data, and not flushed.
+ *
+ * @param fp output stream
+ * @param data planar float array
+ * @param nx, ny, nc image size
+ */
+void io_tiff_write_stream(FILE *fp, const float *data,
+                          size_t nx, size_t ny, size_t nc)
+{
+    unsigned char *hdr, *ent;
+    unsigned *extra;
+    size_t nent, ncolor, nextra, off, hdr_size, x, y, c;
+    const float *ptr;
+    float *row;
+    int big;
+
+    if (0 == nx || 0 == ny || 0 == nc)
+        _IO_TIFF_ABORT("bad image size");
+    if ((double) nx * ny * nc * sizeof(float) > 4294967295.)
+        _IO_TIFF_ABORT("image too large for TIFF");
+    big = _io_tiff_big_endian();
+    ncolor = (3 <= nc ? 3 : 1);
+    nextra = nc - ncolor;
+    nent = (0 < nextra ? 12 : 11);
+
+    /*
+     * header, IFD, BitsPerSample, SampleFormat and ExtraSamples
+     * arrays, then the samples at a 4 bytes boundary
+     */
+    off = 8 + 2 + 12 * nent + 4;
+    hdr_size = off + (2 < nc ? 4 * nc : 0) + (2 < nextra ? 2 * nextra : 0);
+    hdr_size = (hdr_size + 3) / 4 * 4;
+    hdr = (unsigned char *) _io_tiff_safe_malloc(hdr_size);
+    memset(hdr, 0, hdr_size);
+    hdr[0] = hdr[1] = (big ? 'M' : 'I');
+    _io_tiff_put(hdr + 2, 42, 2, big);
+    _io_tiff_put(hdr + 4, 8, 4, big);
+    _io_tiff_put(hdr + 8, (unsigned long) nent, 2, big);
+
+    /* the first extra sample is alpha, the others unspecified */
+    extra = (unsigned *) _io_tiff_safe_malloc((nextra + 1)
+                                              * sizeof(unsigned));
+    extra[0] = 2;
+    for (c = 1; c < nextra; c++)
+        extra[c] = 0;
+
+    ent = hdr + 10;
+    _io_tiff_entry(hdr, ent, _IO_TIFF_WIDTH, _IO_TIFF_LONG, 1, NULL,
+                   (unsigned long) nx, 0, big);
+    _io_tiff_entry(hdr, ent += 12, _IO_TIFF_LENGTH, _IO_TIFF_LONG, 1, NULL,
+                   (unsigned long) ny, 0, big);
+    _io_tiff_entry(hdr, ent += 12, _IO_TIFF_BITS, _IO_TIFF_SHORT, nc, NULL,
+                   32, off, big);
+    if (2 < nc)
+        off += 2 * nc;
+    _io_tiff_entry(hdr, ent += 12, _IO_TIFF_COMPRESSION, _IO_TIFF_SHORT, 1,
+                   NULL, 1, 0, big);
+    _io_tiff_entry(hdr, ent += 12, _IO_TIFF_PHOTOMETRIC, _IO_TIFF_SHORT, 1,
+                   NULL, (3 == ncolor ? 2 : 1), 0, big);
+    _io_tiff_entry(hdr, ent += 12, _IO_TIFF_STRIP_OFFSETS, _IO_TIFF_LONG, 1,
+                   NULL, (unsigned long) hdr_size, 0, big);
+    _io_tiff_entry(hdr, ent += 12, _IO_TIFF_SAMPLES, _IO_TIFF_SHORT, 1,
+                   NULL, (unsigned long) nc, 0, big);
+    _io_tiff_entry(hdr, ent += 12, _IO_TIFF_ROWS_PER_STRIP, _IO_TIFF_LONG, 1,
+                   NULL, (unsigned long) ny, 0, big);
+    _io_tiff_entry(hdr, ent += 12, _IO_TIFF_STRIP_BYTES, _IO_TIFF_LONG, 1,
+                   NULL, (unsigned long) (nx * ny * nc * sizeof(float)), 0,
+                   big);
+    _io_tiff_entry(hdr, ent += 12, _IO_TIFF_PLANAR, _IO_TIFF_SHORT, 1,
+                   NULL, 1, 0, big);
+    if (0 < nextra) {
+        _io_tiff_entry(hdr, ent += 12, _IO_TIFF_EXTRA_SAMPLES,
+                       _IO_TIFF_SHORT, nextra, extra, 0, off, big);
+        if (2 < nextra)
+            off += 2 * nextra;
+    }
+    _io_tiff_entry(hdr, ent += 12, _IO_TIFF_SAMPLE_FORMAT, _IO_TIFF_SHORT,
+                   nc, NULL, _IO_TIFF_IEEEFP, off, big);
+    /* no next IFD, the 4 bytes after the entries are 0 */
+    free(extra);
+
+    if (1 != fwrite(hdr, hdr_size, 1, fp))
+        _IO_TIFF_ABORT("failed to write file");
+    free(hdr);
+
+    row = (float *) _io_tiff_safe_malloc(nx * nc * sizeof(float));
+    for (y = 0; y < ny; y++) {
+        for (c = 0; c < nc; c++) {
+            ptr = data + (c * ny + y) * nx;
+            for (x = 0; x < nx; x++)
+                row[x * nc + c] = ptr[x];
+        }
+        if (nx * nc != fwrite(row, sizeof(float), nx * nc, fp))
+            _IO_TIFF_ABORT("failed to write file");
+    }
+    free(row);
+}
+
+/**
+ * @brief write a planar float array into a float TIFF file
+ *
+ * @param fname file name, "-" means stdout
+ * @param data planar float array
+ * @param nx, ny, nc image size
+ */
+void io_tiff_write(const char *fname, const float *data,
+                   size_t nx, size_t ny, size_t nc)
+{
+    FILE *fp;
+
+    if (0 == strcmp(fname, "-")) {
+        fp = stdout;
+#ifdef WIN32                    /* set the stream to binary mode */
+        fflush(fp);
+        setmode(fileno(fp), O_BINARY);
+#endif
+    }
+    else if (NULL == (fp = fopen(fname, "wb")))
+        _IO_TIFF_ABORT("failed to open file");
+
+    io_tiff_write_stream(fp, data, nx, ny, nc);
+
+    if (stdout == fp)
+        (void) fflush(fp);
+    else if (0 != fclose(fp))
+        _IO_TIFF_ABORT("failed to write file");
+}
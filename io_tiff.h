@@ -0,0 +1,21 @@
+#ifndef _IO_TIFF_H
+#define _IO_TIFF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* io_tiff.c */
+float *io_tiff_read(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp);
+float *io_tiff_read_stream(FILE *fp, size_t *nxp, size_t *nyp, size_t *ncp);
+void io_tiff_write(const char *fname, const float *data, size_t nx, size_t ny, size_t nc);
+void io_tiff_write_stream(FILE *fp, const float *data, size_t nx, size_t ny, size_t nc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_IO_TIFF_H */
@@ -0,0 +1,501 @@
+/*
+ * Copyright 2009-2011 IPOL Image Processing On Line http://www.ipol.im/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file mg.c
+ * @brief multigrid Poisson solver
+ *
+ * Geometric multigrid solver of the discrete Poisson equation with
+ * Neumann boundary conditions, the equation solved by the DCT in
+ * retinex_pde_lib.c: L u = f, with (L u)_i the sum of u_i - u_j for
+ * the neighbours j of i, and no neighbour outside the array.
+ *
+ * The grids are cell-centered. Each level halves the previous one,
+ * in both directions, down to 2 x 2 pixels or less; a direction of
+ * size 1 is not halved, and its neighbours disappear from the
+ * operator, so the thin images become 1D problems instead of
+ * anisotropic ones. The residual is restricted by summing the fine
+ * cells of each coarse cell, and the correction is prolongated by
+ * bilinear interpolation. The coarse operator is the same laplacian,
+ * with x and y weights, equal except after the coarsening of a
+ * single direction. The smoother is a red-black Gauss-Seidel,
+ * parallel by rows.
+ *
+ * The V-cycles stop when the residual norm is below the tolerance
+ * times the right hand side norm; each cycle divides the residual by
+ * about 10. The solution is kept in the solver, and the next solve
+ * can start from it (warm start) instead of 0, to solve a sequence of
+ * similar equations in fewer cycles.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mg.h"
+
+/** smoothing sweeps before and after the coarse correction */
+#define MG_SWEEPS 2
+/** smoothing sweeps on the coarsest grid */
+#define MG_COARSEST_SWEEPS 20
+/** maximum number of V-cycles */
+#define MG_MAX_CYCLES 50
+/** minimum grid size for the parallel loops */
+#define MG_PARALLEL_SIZE 16384
+
+/** coarsening factor in one direction, 2 or 1 */
+#define FACTOR(FINE, COARSE) ((COARSE) < (FINE) ? 2 : 1)
+
+/** multigrid level */
+typedef struct mg_level_s {
+    size_t nx, ny;              /**< grid size */
+    float sx, sy;               /**< operator weights, x and y */
+    float *u;                   /**< solution */
+    float *f;                   /**< right hand side */
+    float *r;                   /**< residual */
+} mg_level_t;
+
+/** multigrid solver */
+struct mg_s {
+    size_t nc;                  /**< number of channels */
+    size_t nlevel;              /**< number of levels */
+    mg_level_t *level;          /**< levels, finest first */
+    float *u;                   /**< finest solutions, nc channels */
+};
+
+/**
+ * @brief allocate a multigrid solver
+ *
+ * @param nx, ny dimension of the arrays
+ * @param nc number of channels
+ *
+ * @return the solver, NULL if the memory is not available, abort()
+ * on other errors
+ */
+mg_t *mg_new(size_t nx, size_t ny, size_t nc)
+{
+    mg_t *mg;
+    mg_level_t *lv;
+    size_t l, n, cx, cy;
+
+    if (0 == nx || 0 == ny || 0 == nc) {
+        fprintf(stderr, "the array size must not be 0\n");
+        abort();
+    }
+
+    /* count the levels */
+    mg = NULL;
+    n = 1;
+    for (cx = nx, cy = ny; 2 < cx || 2 < cy; n++) {
+        cx = (1 < cx ? (cx + 1) / 2 : cx);
+        cy = (1 < cy ? (cy + 1) / 2 : cy);
+    }
+
+    if (NULL == (mg = (mg_t *) malloc(sizeof(mg_t))))
+        return NULL;
+    if (NULL == (mg->level = (mg_level_t *)
+                 malloc(n * sizeof(mg_level_t)))) {
+        free(mg);
+        return NULL;
+    }
+    mg->nc = nc;
+    mg->nlevel = n;
+    /* every array set, or NULL, for mg_free() */
+    for (l = 0; l < n; l++) {
+        mg->level[l].u = NULL;
+        mg->level[l].f = NULL;
+        mg->level[l].r = NULL;
+    }
+
+    /* the finest level arrays are set by mg_solve() */
+    lv = mg->level;
+    lv->nx = nx;
+    lv->ny = ny;
+    lv->sx = 1.;
+    lv->sy = 1.;
+    if (NULL == (mg->u = (float *) calloc(nx * ny * nc, sizeof(float)))
+        || NULL == (lv->r = (float *) malloc(nx * ny * sizeof(float)))) {
+        mg_free(mg);
+        return NULL;
+    }
+    for (l = 1; l < n; l++) {
+        lv = mg->level + l;
+        lv->nx = (1 < lv[-1].nx ? (lv[-1].nx + 1) / 2 : lv[-1].nx);
+        lv->ny = (1 < lv[-1].ny ? (lv[-1].ny + 1) / 2 : lv[-1].ny);
+        /* the flux through a coarse edge, see mg_restrict() */
+        lv->sx = lv[-1].sx * FACTOR(lv[-1].ny, lv->ny)
+            / FACTOR(lv[-1].nx, lv->nx);
+        lv->sy = lv[-1].sy * FACTOR(lv[-1].nx, lv->nx)
+            / FACTOR(lv[-1].ny, lv->ny);
+        if (NULL == (lv->u = (float *) malloc(lv->nx * lv->ny
+                                              * sizeof(float)))
+            || NULL == (lv->f = (float *) malloc(lv->nx * lv->ny
+                                                 * sizeof(float)))
+            || NULL == (lv->r = (float *) malloc(lv->nx * lv->ny
+                                                 * sizeof(float)))) {
+            mg_free(mg);
+            return NULL;
+        }
+    }
+
+    return mg;
+}
+
+/**
+ * @brief free a multigrid solver
+ *
+ * @param mg the solver, may be NULL
+ */
+void mg_free(mg_t *mg)
+{
+    size_t l;
+
+    if (NULL == mg)
+        return;
+
+    /* the finest level u and f are not owned */
+    free(mg->level[0].r);
+    for (l = 1; l < mg->nlevel; l++) {
+        free(mg->level[l].u);
+        free(mg->level[l].f);
+        free(mg->level[l].r);
+    }
+    free(mg->level);
+    free(mg->u);
+    free(mg);
+
+    return;
+}
+
+/**
+ * @brief memory used by a multigrid solver
+ *
+ * @return the size of the solver arrays, in bytes
+ */
+size_t mg_memory(const mg_t *mg)
+{
+    size_t l, size;
+
+    size = (mg->nc + 1) * mg->level[0].nx * mg->level[0].ny;
+    for (l = 1; l < mg->nlevel; l++)
+        size += 3 * mg->level[l].nx * mg->level[l].ny;
+
+    return size * sizeof(float);
+}
+
+/*
+ * V-CYCLE
+ */
+
+/**
+ * @brief laplacian of a pixel, with the missing neighbours ignored
+ *
+ * @param u pointer to the pixel
+ * @param um, up rows above and below, NULL on the edges
+ * @param x, nx column and row length
+ * @param d output, sum of the neighbour weights
+ *
+ * @return the weighted sum of the neighbours
+ */
+static float neighbours(const float *u, const float *um, const float *up,
+                        size_t x, size_t nx, float sx, float sy, float *d)
+{
+    float sum = 0.;
+
+    *d = 0.;
+    if (0 < x) {
+        sum += sx * u[-1];
+        *d += sx;
+    }
+    if (x + 1 < nx) {
+        sum += sx * u[1];
+        *d += sx;
+    }
+    if (NULL != um) {
+        sum += sy * *um;
+        *d += sy;
+    }
+    if (NULL != up) {
+        sum += sy * *up;
+        *d += sy;
+    }
+
+    return sum;
+}
+
+/**
+ * @brief red-black Gauss-Seidel sweeps
+ */
+static void mg_smooth(mg_level_t *lv, int sweeps)
+{
+    const size_t nx = lv->nx, ny = lv->ny;
+    const float sx = lv->sx, sy = lv->sy;
+    const float inv = 1. / (2. * lv->sx + 2. * lv->sy);
+    int s, color;
+    long y;
+
+    for (s = 0; s < sweeps; s++)
+        for (color = 0; color < 2; color++) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if (nx * ny > MG_PARALLEL_SIZE)
+#endif
+            for (y = 0; y < (long) ny; y++) {
+                float *u;
+                const float *f, *um, *up;
+                float sum, d;
+                size_t x;
+
+                u = lv->u + (size_t) y * nx;
+                f = lv->f + (size_t) y * nx;
+                um = (0 < y ? u - nx : NULL);
+                up = ((size_t) y + 1 < ny ? u + nx : NULL);
+                x = (size_t) ((y + color) % 2);
+                if (NULL != um && NULL != up) {
+                    /* inner pixels, without test */
+                    if (0 == x) {
+                        sum = neighbours(u, um, up, 0, nx, sx, sy, &d);
+                        if (0. < d)
+                            u[0] = (f[0] + sum) / d;
+                        x += 2;
+                    }
+                    for (; x + 1 < nx; x += 2)
+                        u[x] = (f[x] + sx * (u[x - 1] + u[x + 1])
+                                + sy * (um[x] + up[x])) * inv;
+                }
+                for (; x < nx; x += 2) {
+                    sum = neighbours(u + x, (NULL == um ? NULL : um + x),
+                                     (NULL == up ? NULL : up + x),
+                                     x, nx, sx, sy, &d);
+                    if (0. < d)
+                        u[x] = (f[x] + sum) / d;
+                }
+            }
+        }
+}
+
+/**
+ * @brief residual r = f - L u
+ *
+ * @return the squared residual norm
+ */
+static double mg_residual(mg_level_t *lv)
+{
+    const size_t nx = lv->nx, ny = lv->ny;
+    const float sx = lv->sx, sy = lv->sy;
+    double norm = 0.;
+    long y;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) reduction(+:norm) \
+    if (nx * ny > MG_PARALLEL_SIZE)
+#endif
+    for (y = 0; y < (long) ny; y++) {
+        const float *u, *f, *um, *up;
+        float *r;
+        float sum, d;
+        size_t x;
+
+        u = lv->u + (size_t) y * nx;
+        f = lv->f + (size_t) y * nx;
+        r = lv->r + (size_t) y * nx;
+        um = (0 < y ? u - nx : NULL);
+        up = ((size_t) y + 1 < ny ? u + nx : NULL);
+        for (x = 0; x < nx; x++) {
+            sum = neighbours(u + x, (NULL == um ? NULL : um + x),
+                             (NULL == up ? NULL : up + x),
+                             x, nx, sx, sy, &d);
+            r[x] = f[x] - (d * u[x] - sum);
+            norm += (double) r[x] * r[x];
+        }
+    }
+
+    return norm;
+}
+
+/**
+ * @brief restriction of the residual to the coarse right hand side
+ *
+ * The coarse right hand side is the sum of the fine residuals in the
+ * coarse cell, ie the residual flux through its edges. The coarse
+ * operator weights account for the coarse distances and edge lengths.
+ */
+static void mg_restrict(mg_level_t *lc, const mg_level_t *lv)
+{
+    const size_t fx = FACTOR(lv->nx, lc->nx), fy = FACTOR(lv->ny, lc->ny);
+    long j;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) \
+    if (lc->nx * lc->ny > MG_PARALLEL_SIZE)
+#endif
+    for (j = 0; j < (long) lc->ny; j++) {
+        size_t i, x, y, x_end, y_end;
+        float sum;
+
+        y_end = ((size_t) j + 1) * fy;
+        y_end = (y_end < lv->ny ? y_end : lv->ny);
+        for (i = 0; i < lc->nx; i++) {
+            x_end = (i + 1) * fx;
+            x_end = (x_end < lv->nx ? x_end : lv->nx);
+            sum = 0.;
+            for (y = (size_t) j * fy; y < y_end; y++)
+                for (x = i * fx; x < x_end; x++)
+                    sum += lv->r[y * lv->nx + x];
+            lc->f[(size_t) j * lc->nx + i] = sum;
+        }
+    }
+}
+
+/**
+ * @brief bilinear prolongation of the coarse correction
+ *
+ * The fine cell centers are at 1/4 of a coarse cell from the coarse
+ * centers, the weights are 3/4 and 1/4, with the edge cells as
+ * neighbours of themselves.
+ */
+static void mg_prolong(mg_level_t *lv, const mg_level_t *lc)
+{
+    const size_t fx = FACTOR(lv->nx, lc->nx), fy = FACTOR(lv->ny, lc->ny);
+    long y;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) \
+    if (lv->nx * lv->ny > MG_PARALLEL_SIZE)
+#endif
+    for (y = 0; y < (long) lv->ny; y++) {
+        const float *e0, *e1;
+        size_t x, i0, i1, j0, j1;
+
+        j0 = (size_t) y / fy;
+        j1 = j0;
+        if (2 == fy) {
+            if (0 == y % 2)
+                j1 = (0 < j0 ? j0 - 1 : j0);
+            else
+                j1 = (j0 + 1 < lc->ny ? j0 + 1 : j0);
+        }
+        e0 = lc->u + j0 * lc->nx;
+        e1 = lc->u + j1 * lc->nx;
+        for (x = 0; x < lv->nx; x++) {
+            i0 = x / fx;
+            i1 = i0;
+            if (2 == fx) {
+                if (0 == x % 2)
+                    i1 = (0 < i0 ? i0 - 1 : i0);
+                else
+                    i1 = (i0 + 1 < lc->nx ? i0 + 1 : i0);
+            }
+            lv->u[(size_t) y * lv->nx + x] +=
+                .75f * (.75f * e0[i0] + .25f * e0[i1])
+                + .25f * (.75f * e1[i0] + .25f * e1[i1]);
+        }
+    }
+}
+
+/**
+ * @brief multigrid V-cycle, from level l
+ */
+static void mg_vcycle(mg_level_t *level, size_t l, size_t nlevel)
+{
+    mg_level_t *lv = level + l;
+    size_t i, size;
+    float mean;
+
+    if (l + 1 == nlevel) {
+        /* coarsest level, project f on the compatible right hand sides */
+        size = lv->nx * lv->ny;
+        mean = 0.;
+        for (i = 0; i < size; i++)
+            mean += lv->f[i];
+        mean /= size;
+        for (i = 0; i < size; i++)
+            lv->f[i] -= mean;
+        mg_smooth(lv, MG_COARSEST_SWEEPS);
+        return;
+    }
+
+    mg_smooth(lv, MG_SWEEPS);
+    (void) mg_residual(lv);
+    mg_restrict(lv + 1, lv);
+    memset(lv[1].u, 0, lv[1].nx * lv[1].ny * sizeof(float));
+    mg_vcycle(level, l + 1, nlevel);
+    mg_prolong(lv, lv + 1);
+    mg_smooth(lv, MG_SWEEPS);
+}
+
+/**
+ * @brief multigrid Poisson solver
+ *
+ * Solve L u = rhs for every channel, with V-cycles until the residual
+ * norm is below tol times the rhs norm, or MG_MAX_CYCLES cycles. The
+ * solution has a zero mean.
+ *
+ * @param mg multigrid solver
+ * @param data output array, nc contiguous channels
+ * @param rhs right hand side, nc contiguous channels
+ * @param tol relative tolerance
+ * @param warm 1 to start from the previous solution, 0 to start from 0
+ *
+ * @return the largest number of V-cycles among the channels
+ */
+int mg_solve(mg_t *mg, float *data, const float *rhs, double tol, int warm)
+{
+    mg_level_t *lv;
+    size_t c, i, size;
+    double fnorm, mean;
+    int cycles, max_cycles = 0;
+
+    if (NULL == mg || NULL == data || NULL == rhs) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
+    }
+
+    lv = mg->level;
+    size = lv->nx * lv->ny;
+    for (c = 0; c < mg->nc; c++) {
+        lv->u = mg->u + c * size;
+        /* the finest right hand side is only read */
+        lv->f = (float *) rhs + c * size;
+        if (!warm)
+            memset(lv->u, 0, size * sizeof(float));
+
+        fnorm = 0.;
+        for (i = 0; i < size; i++)
+            fnorm += (double) lv->f[i] * lv->f[i];
+        for (cycles = 0; cycles < MG_MAX_CYCLES; cycles++) {
+            if (mg_residual(lv) <= tol * tol * fnorm)
+                break;
+            mg_vcycle(mg->level, 0, mg->nlevel);
+        }
+        if (cycles > max_cycles)
+            max_cycles = cycles;
+
+        /* zero mean */
+        mean = 0.;
+        for (i = 0; i < size; i++)
+            mean += lv->u[i];
+        mean /= size;
+        for (i = 0; i < size; i++) {
+            lv->u[i] -= mean;
+            data[c * size + i] = lv->u[i];
+        }
+    }
+    lv->u = NULL;
+    lv->f = NULL;
+
+    return max_cycles;
+}
@@ -0,0 +1,23 @@
+#ifndef _MG_H
+#define _MG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/** opaque multigrid Poisson solver */
+typedef struct mg_s mg_t;
+
+/* mg.c */
+mg_t *mg_new(size_t nx, size_t ny, size_t nc);
+void mg_free(mg_t *mg);
+size_t mg_memory(const mg_t *mg);
+int mg_solve(mg_t *mg, float *data, const float *rhs, double tol, int warm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_MG_H */
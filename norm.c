@@ -29,55 +29,109 @@
 
 #include "norm.h"
 
+/** number of partial sums in norm_stats() */
+#define NORM_BLOCKS 256
+
 /**
- * @brief compute mean and variance of a float array
+ * @brief compute the mean and standard deviation of a float array
+ *
+ * The sum and the sum of squares are computed in a single pass, in
+ * double precision, as NORM_BLOCKS partial sums over contiguous
+ * blocks, then added in order with Kahan compensation. The rounding
+ * error grows with the block size instead of the array size, and
+ * with OpenMP, the blocks are summed in parallel with the same
+ * result whatever the number of threads.
  *
+ * @param stats statistics, filled
  * @param data float array
  * @param size array size
- * @param mean_p, dt_p addresses to store the mean and variance
  */
-static void mean_dt(const float *data, size_t size,
-                    double *mean_p, double *dt_p)
+void norm_stats(norm_stats_t *stats, const float *data, size_t size)
 {
-    double mean, dt;
-    const float *ptr_data;
-    size_t i;
+    double sum[NORM_BLOCKS], sum2[NORM_BLOCKS];
+    double mean, dt, c, c2, y, tmp;
+    size_t bsize;
+    long k;
+
+    /* sanity check */
+    if (NULL == stats || NULL == data) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
+    }
+    if (0 == size) {
+        fprintf(stderr, "the array is empty, no statistics\n");
+        abort();
+    }
+
+    bsize = (size + NORM_BLOCKS - 1) / NORM_BLOCKS;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (k = 0; k < NORM_BLOCKS; k++) {
+        const float *ptr_data;
+        double s, s2, v;
+        size_t i, i0, i1;
+
+        i0 = (size_t) k * bsize;
+        i1 = (i0 + bsize < size ? i0 + bsize : size);
+        ptr_data = data;
+        s = 0.;
+        s2 = 0.;
+        for (i = i0; i < i1; i++) {
+            v = ptr_data[i];
+            s += v;
+            s2 += v * v;
+        }
+        sum[k] = s;
+        sum2[k] = s2;
+    }
 
+    /* Kahan summation of the partial sums */
     mean = 0.;
     dt = 0.;
-    ptr_data = data;
-    for (i = 0; i < size; i++) {
-        mean += *ptr_data;
-        dt += (*ptr_data) * (*ptr_data);
-        ptr_data++;
+    c = 0.;
+    c2 = 0.;
+    for (k = 0; k < NORM_BLOCKS; k++) {
+        y = sum[k] - c;
+        tmp = mean + y;
+        c = (tmp - mean) - y;
+        mean = tmp;
+        y = sum2[k] - c2;
+        tmp = dt + y;
+        c2 = (tmp - dt) - y;
+        dt = tmp;
     }
     mean /= (double) size;
     dt /= (double) size;
     dt -= (mean * mean);
-    dt = sqrt(dt);
+    dt = sqrt(dt > 0. ? dt : 0.);
 
-    *mean_p = mean;
-    *dt_p = dt;
+    stats->mean = mean;
+    stats->dt = dt;
 
     return;
 }
 
 /**
- * @brief normalize mean and variance of a float array given a reference
- *        array
+ * @brief normalize mean and variance of a float array given the
+ *        reference statistics
  *
- * The normalized array is normalized by an affine transformation
- * to adjust its mean and variance to a reference array.
+ * Same as normalize_mean_dt(), with the statistics of the reference
+ * array computed beforehand by norm_stats(), for example before the
+ * reference array is overwritten, or once for several arrays. The
+ * array is read twice, for its statistics then for the affine
+ * transformation.
  *
  * @param data normalized array
- * @param ref reference array
- * @param size size of the arrays
+ * @param ref reference statistics
+ * @param size size of the array
  */
-void normalize_mean_dt(float *data, const float *ref, size_t size)
+void normalize_mean_dt_stats(float *data, const norm_stats_t *ref,
+                             size_t size)
 {
-    double mean_ref, mean_data, dt_ref, dt_data;
+    norm_stats_t st;
     double a, b;
-    size_t i;
+    long i;
     float *ptr_data;
 
     /* sanity check */
@@ -86,20 +140,47 @@ void normalize_mean_dt(float *data, const float *ref, size_t size)
         abort();
     }
 
-    /* compute mean and variance of the two arrays */
-    mean_dt(ref, size, &mean_ref, &dt_ref);
-    mean_dt(data, size, &mean_data, &dt_data);
+    /* compute mean and variance of the array */
+    norm_stats(&st, data, size);
 
     /* compute the normalization coefficients */
-    a = dt_ref / dt_data;
-    b = mean_ref - a * mean_data;
+    a = ref->dt / st.dt;
+    b = ref->mean - a * st.mean;
 
     /* normalize the array */
     ptr_data = data;
-    for (i = 0; i < size; i++) {
-        *ptr_data = a * *ptr_data + b;
-        ptr_data++;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (i = 0; i < (long) size; i++)
+        ptr_data[i] = a * ptr_data[i] + b;
+
+    return;
+}
+
+/**
+ * @brief normalize mean and variance of a float array given a reference
+ *        array
+ *
+ * The normalized array is normalized by an affine transformation
+ * to adjust its mean and variance to a reference array.
+ *
+ * @param data normalized array
+ * @param ref reference array
+ * @param size size of the arrays
+ */
+void normalize_mean_dt(float *data, const float *ref, size_t size)
+{
+    norm_stats_t st_ref;
+
+    /* sanity check */
+    if (NULL == data || NULL == ref) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
     }
 
+    norm_stats(&st_ref, ref, size);
+    normalize_mean_dt_stats(data, &st_ref, size);
+
     return;
 }
@@ -5,7 +5,17 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+
+/** mean and standard deviation of an array, see norm_stats() */
+typedef struct norm_stats_s {
+    double mean;                /**< mean */
+    double dt;                  /**< standard deviation */
+} norm_stats_t;
+
 /* norm.c */
+void norm_stats(norm_stats_t *stats, const float *data, size_t size);
+void normalize_mean_dt_stats(float *data, const norm_stats_t *ref, size_t size);
 void normalize_mean_dt(float *data, const float *ref, size_t size);
 
 #ifdef __cplusplus
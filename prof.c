@@ -0,0 +1,358 @@
+/*
+ * Copyright 2009-2011 IPOL Image Processing On Line http://www.ipol.im/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file prof.c
+ * @brief pipeline stage profiling, in release builds
+ *
+ * Unlike the debug.h timers, the profiler is compiled in every build
+ * and switched on at runtime by prof_enable(); when it is off, a
+ * stage costs a test. Each stage, between prof_start() and
+ * prof_stop(), adds to the totals of its calling thread:
+ * @li the monotonic wall time;
+ * @li the CPU time of the calling thread;
+ * @li on Linux, optionally, the cycles, instructions and cache misses
+ *     of the calling thread, with perf_event_open(); the counters are
+ *     not available if the kernel refuses them (see
+ *     /proc/sys/kernel/perf_event_paranoid), and are not built with
+ *     -DPROF_NO_PERF.
+ *
+ * The threads are the OpenMP threads calling the stages, as the
+ * workers of the batch and server modes; the CPU time and counters
+ * of the OpenMP threads working inside a multi-threaded stage (-j) are
+ * not included, compare the wall time of the stage to measure them.
+ * The totals accumulate over all the images, and are written in JSON
+ * by prof_write().
+ */
+
+#if defined(__linux__) && !defined(PROF_NO_PERF)
+/* Linux: syscall(), perf_event_open() */
+#define _GNU_SOURCE
+#define PROF_PERF
+#else
+/* POSIX: monotonic and thread CPU clocks */
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* unified Windows detection, see io_png.c */
+#if (defined(_WIN32) || defined(__WIN32__) \
+     || defined(__TOS_WIN__) || defined(__WINDOWS__))
+#ifndef WIN32
+#define WIN32
+#endif
+#else
+/* POSIX: _POSIX_TIMERS and _POSIX_THREAD_CPUTIME */
+#include <unistd.h>
+#endif
+
+#ifdef PROF_PERF
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* ensure consistency */
+#include "prof.h"
+
+/** maximum number of profiled threads, the others share the slots */
+#define PROF_THREADS 64
+
+/** stage names, in prof_stage_t order */
+static const char *_prof_stage_name[PROF_NSTAGE] = {
+    "decode", "laplace", "dct_fw", "poisson", "dct_bw", "multigrid",
+    "normalize", "encode"
+};
+
+/** counter names */
+static const char *_prof_counter_name[PROF_NCOUNTER] = {
+    "cycles", "instructions", "cache_misses"
+};
+
+/** totals of a stage in a thread */
+typedef struct prof_acc_s {
+    unsigned long calls;        /**< number of calls */
+    unsigned long counted;      /**< number of calls with counters */
+    double wall, cpu;           /**< times, in seconds */
+    double count[PROF_NCOUNTER];        /**< counter totals */
+} prof_acc_t;
+
+/** profiling switch, see prof_enable() */
+static int _prof_on = 0;
+/** hardware counters switch */
+static int _prof_counters = 0;
+/** profiling start time */
+static double _prof_wall0 = 0.;
+/** totals, per thread and stage */
+static prof_acc_t _prof_acc[PROF_THREADS][PROF_NSTAGE];
+
+#ifdef PROF_PERF
+/** counter file descriptors, per thread, the first is the leader */
+static int _prof_fd[PROF_THREADS][PROF_NCOUNTER];
+/** system thread of the counters, 0 if none, -1 if not available */
+static long _prof_tid[PROF_THREADS];
+#endif
+
+/**
+ * @brief wall clock time, in seconds
+ */
+static double prof_wall(void)
+{
+#if defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0)
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1E-9 * (double) ts.tv_nsec;
+#elif defined(_OPENMP)
+    return omp_get_wtime();
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/**
+ * @brief CPU time of the calling thread, in seconds
+ *
+ * Without thread CPU clocks, this is the process CPU time.
+ */
+static double prof_cpu(void)
+{
+#if defined(_POSIX_THREAD_CPUTIME) && (_POSIX_THREAD_CPUTIME >= 0)
+    struct timespec ts;
+
+    if (0 == clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return (double) ts.tv_sec + 1E-9 * (double) ts.tv_nsec;
+#endif
+    return (double) clock() / CLOCKS_PER_SEC;
+}
+
+/** profiling slot of the calling thread */
+static int prof_slot(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num() % PROF_THREADS;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief read the hardware counters of the calling thread
+ *
+ * The counters are opened at the first read in a thread, and again
+ * if another system thread uses the slot.
+ *
+ * @param slot profiling slot
+ * @param count counter values, filled
+ *
+ * @return 0 on success, -1 if the counters are not available
+ */
+static int prof_read(int slot, double *count)
+{
+#ifdef PROF_PERF
+    static const unsigned long config[PROF_NCOUNTER] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES
+    };
+    struct perf_event_attr attr;
+    __u64 buf[1 + PROF_NCOUNTER];
+    long tid;
+    int i;
+
+    if (-1 == _prof_tid[slot])
+        return -1;
+    tid = syscall(SYS_gettid);
+    if (tid != _prof_tid[slot]) {
+        if (0 != _prof_tid[slot])
+            for (i = 0; i < PROF_NCOUNTER; i++)
+                (void) close(_prof_fd[slot][i]);
+        /* one group per thread, read at once */
+        for (i = 0; i < PROF_NCOUNTER; i++) {
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = config[i];
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            _prof_fd[slot][i] = (int) syscall(SYS_perf_event_open, &attr,
+                                              0, -1,
+                                              (0 == i ? -1
+                                               : _prof_fd[slot][0]), 0);
+            if (0 > _prof_fd[slot][i]) {
+                while (i-- > 0)
+                    (void) close(_prof_fd[slot][i]);
+                _prof_tid[slot] = -1;
+                return -1;
+            }
+        }
+        _prof_tid[slot] = tid;
+    }
+    if ((ssize_t) sizeof(buf)
+        != read(_prof_fd[slot][0], buf, sizeof(buf))
+        || PROF_NCOUNTER != buf[0])
+        return -1;
+    for (i = 0; i < PROF_NCOUNTER; i++)
+        count[i] = (double) buf[1 + i];
+    return 0;
+#else
+    (void) slot;
+    (void) count;
+    return -1;
+#endif
+}
+
+/**
+ * @brief switch the profiler on
+ *
+ * Must be called before the profiled stages, not concurrently.
+ *
+ * @param counters also read the hardware counters, if available
+ */
+void prof_enable(int counters)
+{
+    _prof_on = 1;
+    _prof_counters = counters;
+    _prof_wall0 = prof_wall();
+}
+
+/**
+ * @brief start a stage
+ *
+ * @param mark stage start mark, filled, for prof_stop()
+ */
+void prof_start(prof_mark_t *mark)
+{
+    if (0 == (mark->on = _prof_on))
+        return;
+    mark->counted = (_prof_counters
+                     && 0 == prof_read(prof_slot(), mark->count));
+    mark->cpu = prof_cpu();
+    mark->wall = prof_wall();
+}
+
+/**
+ * @brief stop a stage, and add it to the totals of the calling thread
+ *
+ * The stage is started and stopped in the same thread.
+ *
+ * @param mark stage start mark, from prof_start()
+ * @param stage profiled stage
+ */
+void prof_stop(prof_mark_t *mark, prof_stage_t stage)
+{
+    double wall, cpu, count[PROF_NCOUNTER];
+    prof_acc_t *acc;
+    int slot, i;
+
+    if (!mark->on)
+        return;
+    wall = prof_wall();
+    cpu = prof_cpu();
+    slot = prof_slot();
+    acc = &_prof_acc[slot][stage];
+    acc->calls++;
+    acc->wall += wall - mark->wall;
+    acc->cpu += cpu - mark->cpu;
+    if (mark->counted && 0 == prof_read(slot, count)) {
+        acc->counted++;
+        for (i = 0; i < PROF_NCOUNTER; i++)
+            acc->count[i] += count[i] - mark->count[i];
+    }
+}
+
+/**
+ * @brief write the profile, in JSON
+ *
+ * The profile has the total wall time since prof_enable(), and for
+ * each stage, in pipeline order, the number of calls, the wall and
+ * CPU times, in seconds, the counter totals, or null if the counters
+ * were not read for every call, and the same totals per thread.
+ *
+ * @param fname file name, "-" means stdout
+ *
+ * @return 0 on success, -1 on error
+ */
+int prof_write(const char *fname)
+{
+    FILE *fp;
+    prof_acc_t tot, *acc;
+    int s, k, i, first;
+
+    if (0 == strcmp(fname, "-"))
+        fp = stdout;
+    else if (NULL == (fp = fopen(fname, "w")))
+        return -1;
+
+    fprintf(fp, "{\n  \"wall_s\": %.6f,\n  \"stages\": [",
+            prof_wall() - _prof_wall0);
+    for (s = 0; s < PROF_NSTAGE; s++) {
+        memset(&tot, 0, sizeof(tot));
+        for (k = 0; k < PROF_THREADS; k++) {
+            acc = &_prof_acc[k][s];
+            tot.calls += acc->calls;
+            tot.counted += acc->counted;
+            tot.wall += acc->wall;
+            tot.cpu += acc->cpu;
+            for (i = 0; i < PROF_NCOUNTER; i++)
+                tot.count[i] += acc->count[i];
+        }
+        fprintf(fp, "%s\n    {\"stage\": \"%s\", \"calls\": %lu, "
+                "\"wall_s\": %.6f, \"cpu_s\": %.6f",
+                (0 == s ? "" : ","), _prof_stage_name[s], tot.calls,
+                tot.wall, tot.cpu);
+        for (i = 0; i < PROF_NCOUNTER; i++)
+            if (0 < tot.calls && tot.counted == tot.calls)
+                fprintf(fp, ", \"%s\": %.0f", _prof_counter_name[i],
+                        tot.count[i]);
+            else
+                fprintf(fp, ", \"%s\": null", _prof_counter_name[i]);
+        fprintf(fp, ",\n     \"threads\": [");
+        for (k = 0, first = 1; k < PROF_THREADS; k++) {
+            acc = &_prof_acc[k][s];
+            if (0 == acc->calls)
+                continue;
+            fprintf(fp, "%s{\"thread\": %d, \"calls\": %lu, "
+                    "\"wall_s\": %.6f, \"cpu_s\": %.6f}",
+                    (first ? "" : ", "), k, acc->calls, acc->wall,
+                    acc->cpu);
+            first = 0;
+        }
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+
+#ifdef PROF_PERF
+    for (k = 0; k < PROF_THREADS; k++)
+        if (0 < _prof_tid[k]) {
+            for (i = 0; i < PROF_NCOUNTER; i++)
+                (void) close(_prof_fd[k][i]);
+            _prof_tid[k] = 0;
+        }
+#endif
+
+    if (stdout == fp)
+        return (0 == fflush(fp) ? 0 : -1);
+    return (0 == fclose(fp) ? 0 : -1);
+}
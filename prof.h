@@ -0,0 +1,42 @@
+#ifndef _PROF_H
+#define _PROF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** profiled stages, in pipeline order */
+typedef enum prof_stage_e {
+    PROF_DECODE = 0,            /**< image reading */
+    PROF_LAPLACE = 1,           /**< thresholded laplacians */
+    PROF_DCT_FW = 2,            /**< forward DCT */
+    PROF_POISSON = 3,           /**< Poisson step, in Fourier space */
+    PROF_DCT_BW = 4,            /**< backward DCT */
+    PROF_MULTIGRID = 5,         /**< multigrid Poisson solver */
+    PROF_NORMALIZE = 6,         /**< mean and variance normalization */
+    PROF_ENCODE = 7,            /**< image writing */
+    PROF_NSTAGE = 8
+} prof_stage_t;
+
+/** number of hardware counters */
+#define PROF_NCOUNTER 3
+
+/** stage start mark, filled by prof_start() */
+typedef struct prof_mark_s {
+    int on;                     /**< profiling on at the start */
+    double wall, cpu;           /**< start times, in seconds */
+    double count[PROF_NCOUNTER];        /**< start counter values */
+    int counted;                /**< counter values available */
+} prof_mark_t;
+
+/* prof.c */
+void prof_enable(int counters);
+void prof_start(prof_mark_t *mark);
+void prof_stop(prof_mark_t *mark, prof_stage_t stage);
+int prof_write(const char *fname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_PROF_H */
@@ -26,87 +26,1483 @@
  * @author Nicolas Limare <nicolas.limare@cmla.ens-cachan.fr>
  */
 
+/* POSIX: directory listing, monotonic clock, resource usage */
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "retinex_pde_lib.h"
 #include "io_png.h"
+#include "io_raw.h"
+#include "io_pfm.h"
+#include "io_tiff.h"
 #include "norm.h"
+#include "serve.h"
+#include "tile.h"
+#include "prof.h"
 #include "debug.h"
 
+/** number of solver contexts kept by each batch worker */
+#define BATCH_CACHE_SIZE 4
+
+/** image file formats, other than raw */
+typedef enum fmt_file_e {
+    FMT_PNG = 0,                /* PNG, see io_png.c */
+    FMT_PFM = 1,                /* PFM, see io_pfm.c */
+    FMT_TIFF = 2                /* float TIFF, see io_tiff.c */
+} fmt_file_t;
+
+/** input and output file formats, PNG, PFM, TIFF or raw, see io_raw.c */
+typedef struct fmt_s {
+    int raw_in, raw_out;        /* raw instead of file_in, file_out */
+    fmt_file_t file_in, file_out;       /* image file formats */
+    io_raw_type_t type_in, type_out;    /* raw sample layouts */
+    size_t nx, ny, nc;          /* headerless raw input size, or 0 */
+    int header_out;             /* raw output header */
+    io_png_opt_t png_opt;       /* PNG output options */
+} fmt_t;
+
+/**
+ * @brief print the usage info
+ */
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage : %s [options] T in.png rtnx.png\n", name);
+    fprintf(stderr, "        %s [options] --batch list T outdir\n", name);
+    fprintf(stderr, "        %s [options] --warm-wisdom WxH[xC],...\n",
+            name);
+    fprintf(stderr, "        %s [options] --serve socket\n", name);
+    fprintf(stderr, "        %s [options] --video T in out\n", name);
+    fprintf(stderr, "        %s [options] --thresholds T1,T2,... in out\n",
+            name);
+    fprintf(stderr, "        T retinex threshold [0,1[\n");
+    fprintf(stderr, "options :\n");
+    fprintf(stderr, "        -p plan    DCT planning, "
+            "estimate (default), measure or patient\n");
+    fprintf(stderr, "        -w wisdom  load and save the FFTW wisdom\n");
+    fprintf(stderr, "        -j N       use N threads "
+            "(default: $RETINEX_THREADS or 1)\n");
+    fprintf(stderr, "        --pad      pad the DCT to FFT-friendly "
+            "sizes, approximate\n");
+    fprintf(stderr, "        --solver s Poisson solver, "
+            "dct (default) or multigrid\n");
+    fprintf(stderr, "        --tol tol  multigrid relative tolerance "
+            "(default: 1E-4)\n");
+    fprintf(stderr, "        --precision p  DCT precision, "
+            "float (default), double or long\n");
+    fprintf(stderr, "        --in fmt   input format, png (default), "
+            "pfm, tiff, raw (T) or headerless raw (T:WxHxC)\n");
+    fprintf(stderr, "        --out fmt  output format, png (default), "
+            "png:fast, png:16, pfm, tiff,\n");
+    fprintf(stderr, "                   raw (T) or headerless raw "
+            "(T:noheader)\n");
+    fprintf(stderr, "                   raw T: f32, f32i (float), "
+            "u8, u8i (8bit), i for interleaved\n");
+    fprintf(stderr, "        --tile-mem size  tiled processing in this "
+            "memory (512K, 64M, 4G), f32 raw output\n");
+    fprintf(stderr, "        --low-mem  memory-minimal processing, "
+            "one channel at a time, in place\n");
+    fprintf(stderr, "        --peak-mem print the peak resident "
+            "memory at the end\n");
+    fprintf(stderr, "        --profile file  write the stage times "
+            "and counters in JSON (- for stdout)\n");
+    fprintf(stderr, "        --batch    process the PNG images of a "
+            "directory, or listed in a file (- for stdin)\n");
+    fprintf(stderr, "        --serve    process the requests received "
+            "on a Unix socket, see serve.c\n");
+    fprintf(stderr, "        --video    process video frames, numbered "
+            "files (in%%04d.png) or a stream (- for stdin/stdout)\n");
+    fprintf(stderr, "        --thresholds  process an image with "
+            "these thresholds, into out%%d.png or a stream\n");
+    fprintf(stderr, "        --warm-wisdom  plan these sizes "
+            "(default: measure) and save the wisdom\n");
+    return;
+}
+
+/**
+ * @brief plan the DCT for a list of image sizes
+ *
+ * The sizes are WxH or WxHxC items, separated by commas. Without C,
+ * the gray (1 channel) and color (3 channels) plans are created.
+ *
+ * @param sizes image size list
+ *
+ * @return 0 on success, -1 on a syntax error
+ */
+static int warm_wisdom(const char *sizes)
+{
+    const char *ptr;
+    char *end;
+    unsigned long nx, ny, nc;
+    retinex_pde_ctx_t *ctx;
+
+    ptr = sizes;
+    while ('\0' != *ptr) {
+        nx = strtoul(ptr, &end, 10);
+        if (end == ptr || 'x' != *end)
+            return -1;
+        ptr = end + 1;
+        ny = strtoul(ptr, &end, 10);
+        if (end == ptr)
+            return -1;
+        nc = 0;
+        if ('x' == *end) {
+            ptr = end + 1;
+            nc = strtoul(ptr, &end, 10);
+            if (end == ptr || 0 == nc)
+                return -1;
+        }
+        if (0 == nx || 0 == ny || (',' != *end && '\0' != *end))
+            return -1;
+        ptr = (',' == *end ? end + 1 : end);
+
+        if (0 == nc || 1 == nc) {
+            ctx = retinex_pde_ctx_new((size_t) nx, (size_t) ny, 1);
+            retinex_pde_ctx_free(ctx);
+        }
+        if (0 == nc || 1 < nc) {
+            ctx = retinex_pde_ctx_new((size_t) nx, (size_t) ny,
+                                      (size_t) (0 == nc ? 3 : nc));
+            retinex_pde_ctx_free(ctx);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief parse an input or output file format
+ *
+ * The format is png, pfm, tiff, a raw type, or a raw type followed by
+ * the image size (WxHxC, input) or "noheader" (output) for headerless
+ * raw files.
+ * The PNG output format can have the options ":fast", for a faster
+ * compression, and ":16", for 16bit samples, as "png:16:fast".
+ *
+ * @param str format string
+ * @param fmt file formats, updated
+ * @param out 0 for the input format, 1 for the output format
+ *
+ * @return 0 on success, -1 on a syntax error
+ */
+static int parse_fmt(const char *str, fmt_t *fmt, int out)
+{
+    char name[8];
+    const char *sep;
+    io_raw_type_t type;
+    fmt_file_t file;
+    unsigned long nx, ny, nc;
+    size_t len;
+    char end;
+
+    if (0 == strcmp(str, "png") || 0 == strcmp(str, "pfm")
+        || 0 == strcmp(str, "tiff")) {
+        file = (0 == strcmp(str, "pfm") ? FMT_PFM
+                : 0 == strcmp(str, "tiff") ? FMT_TIFF : FMT_PNG);
+        if (out) {
+            fmt->raw_out = 0;
+            fmt->file_out = file;
+            fmt->png_opt = IO_PNG_OPT_NONE;
+        }
+        else {
+            fmt->raw_in = 0;
+            fmt->file_in = file;
+        }
+        return 0;
+    }
+    if (out && 0 == strncmp(str, "png:", 4)) {
+        fmt->raw_out = 0;
+        fmt->file_out = FMT_PNG;
+        fmt->png_opt = IO_PNG_OPT_NONE;
+        sep = str + 3;
+        while (':' == *sep) {
+            len = strcspn(sep + 1, ":");
+            if (4 == len && 0 == strncmp(sep + 1, "fast", 4))
+                fmt->png_opt = (io_png_opt_t) (fmt->png_opt
+                                               | IO_PNG_OPT_ZFAST);
+            else if (2 == len && 0 == strncmp(sep + 1, "16", 2))
+                fmt->png_opt = (io_png_opt_t) (fmt->png_opt
+                                               | IO_PNG_OPT_16BIT);
+            else
+                return -1;
+            sep += 1 + len;
+        }
+        return 0;
+    }
+
+    sep = strchr(str, ':');
+    if (NULL == sep)
+        sep = str + strlen(str);
+    if ((size_t) (sep - str) >= sizeof(name))
+        return -1;
+    memcpy(name, str, sep - str);
+    name[sep - str] = '\0';
+    if (0 != io_raw_type(name, &type))
+        return -1;
+
+    if (out) {
+        if ('\0' != *sep && 0 != strcmp(sep, ":noheader"))
+            return -1;
+        fmt->raw_out = 1;
+        fmt->type_out = type;
+        fmt->header_out = ('\0' == *sep);
+    }
+    else {
+        nx = ny = nc = 0;
+        if ('\0' != *sep
+            && (3 != sscanf(sep, ":%lux%lux%lu%c", &nx, &ny, &nc, &end)
+                || 0 != io_raw_check_size((size_t) nx, (size_t) ny,
+                                          (size_t) nc)))
+            return -1;
+        fmt->raw_in = 1;
+        fmt->type_in = type;
+        fmt->nx = (size_t) nx;
+        fmt->ny = (size_t) ny;
+        fmt->nc = (size_t) nc;
+    }
+    return 0;
+}
+
+/**
+ * @brief parse a memory size
+ *
+ * @param str number of bytes, with a K, M (default) or G suffix
+ *
+ * @return the size in bytes, 0 on a syntax error
+ */
+static size_t parse_mem(const char *str)
+{
+    char *end;
+    unsigned long size;
+
+    size = strtoul(str, &end, 10);
+    if (end == str)
+        return 0;
+    switch (*end) {
+    case 'K':
+        return (size_t) size << 10;
+    case '\0':
+    case 'M':
+        return (size_t) size << 20;
+    case 'G':
+        return (size_t) size << 30;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief wall clock time, in seconds
+ */
+static double wall_time(void)
+{
+#if defined(_OPENMP)
+    return omp_get_wtime();
+#elif defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0)
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1E-9 * (double) ts.tv_nsec;
+#else
+    return (double) time(NULL);
+#endif
+}
+
+/**
+ * @brief peak resident memory of the process, in bytes
+ *
+ * @return the peak memory, or 0 if not available
+ */
+static double peak_memory(void)
+{
+    struct rusage ru;
+
+    if (0 != getrusage(RUSAGE_SELF, &ru))
+        return 0.;
+#ifdef __APPLE__
+    return (double) ru.ru_maxrss;
+#else
+    return 1024. * (double) ru.ru_maxrss;
+#endif
+}
+
+/** memory-minimal processing, see --low-mem */
+static int low_mem = 0;
+
+/**
+ * @brief process an image
+ *
+ * The non-alpha channels of the image are processed by the retinex
+ * transform, then normalized to the mean and variance of the input.
+ * The input statistics are computed first, and the image is processed
+ * in place, without copy. With --low-mem, the channels are processed
+ * one at a time in a single channel context, see
+ * retinex_pde_low_memory().
+ *
+ * @param data image array, RRR GGG BBB AAA, updated
+ * @param nx, ny, nc image size
+ * @param t retinex threshold
+ * @param cache solver context cache
+ *
+ * @return 0 on success, -1 on error
+ */
+static int retinex_image(float *data, size_t nx, size_t ny, size_t nc,
+                         float t, retinex_pde_cache_t *cache)
+{
+    size_t channel, nc_non_alpha, nc_ctx;
+    norm_stats_t ref[3];        /* input statistics */
+    retinex_pde_ctx_t *ctx;     /* retinex solver context */
+    prof_mark_t mark;           /* stage profiling */
+
+    /* the image has either 1 or 3 non-alpha channels */
+    if (3 <= nc)
+        nc_non_alpha = 3;
+    else
+        nc_non_alpha = 1;
+
+    /* the input statistics, before the data is overwritten */
+    prof_start(&mark);
+    for (channel = 0; channel < nc_non_alpha; channel++)
+        norm_stats(ref + channel, data + channel * nx * ny, nx * ny);
+    prof_stop(&mark, PROF_NORMALIZE);
+
+    /*
+     * run retinex on all the non-alpha channels at once, or one at a
+     * time, then normalize mean and standard deviation of each channel
+     */
+    nc_ctx = (low_mem ? 1 : nc_non_alpha);
+    if (NULL == (ctx = retinex_pde_cache_get(cache, nx, ny, nc_ctx))) {
+        fprintf(stderr, "not enough memory for the solver\n");
+        return -1;
+    }
+    for (channel = 0; channel < nc_non_alpha; channel += nc_ctx)
+        if (NULL == retinex_pde_ctx_run(ctx, data + channel * nx * ny, t)) {
+            fprintf(stderr, "the retinex PDE failed\n");
+            return -1;
+        }
+    prof_start(&mark);
+    for (channel = 0; channel < nc_non_alpha; channel++)
+        normalize_mean_dt_stats(data + channel * nx * ny, ref + channel,
+                                nx * ny);
+    prof_stop(&mark, PROF_NORMALIZE);
+
+    return 0;
+}
+
+/**
+ * @brief read an image file
+ *
+ * @param fname file name, "-" means stdin
+ * @param fmt input file format
+ * @param raw raw image, for raw files
+ * @param nxp, nyp, ncp pointers to the image size, filled
+ *
+ * @return the image array, released by image_free(), NULL on error
+ */
+static float *image_read(const char *fname, const fmt_t *fmt,
+                         io_raw_t *raw, size_t *nxp, size_t *nyp,
+                         size_t *ncp)
+{
+    float *data;
+    prof_mark_t mark;
+
+    prof_start(&mark);
+    if (fmt->raw_in) {
+        raw->nx = fmt->nx;
+        raw->ny = fmt->ny;
+        raw->nc = fmt->nc;
+        data = io_raw_read(raw, fname, fmt->type_in);
+        *nxp = raw->nx;
+        *nyp = raw->ny;
+        *ncp = raw->nc;
+    }
+    else if (FMT_PFM == fmt->file_in)
+        data = io_pfm_read(fname, nxp, nyp, ncp);
+    else if (FMT_TIFF == fmt->file_in)
+        data = io_tiff_read(fname, nxp, nyp, ncp);
+    else
+        data = io_png_read_flt(fname, nxp, nyp, ncp);
+    prof_stop(&mark, PROF_DECODE);
+    return data;
+}
+
+/** release an image read by image_read() */
+static void image_free(const fmt_t *fmt, io_raw_t *raw, float *data)
+{
+    if (fmt->raw_in)
+        io_raw_free(raw);
+    else
+        free(data);
+}
+
+/**
+ * @brief write an image file
+ *
+ * @param fname file name, "-" means stdout
+ * @param fmt output file format
+ * @param data image array
+ * @param nx, ny, nc image size
+ */
+static void image_write(const char *fname, const fmt_t *fmt,
+                        const float *data, size_t nx, size_t ny, size_t nc)
+{
+    prof_mark_t mark;
+
+    prof_start(&mark);
+    if (fmt->raw_out)
+        io_raw_write(fname, data, nx, ny, nc,
+                     fmt->type_out, fmt->header_out);
+    else if (FMT_PFM == fmt->file_out)
+        io_pfm_write(fname, data, nx, ny, nc);
+    else if (FMT_TIFF == fmt->file_out)
+        io_tiff_write(fname, data, nx, ny, nc);
+    else
+        io_png_write_flt_opt(fname, data, nx, ny, nc, fmt->png_opt);
+    prof_stop(&mark, PROF_ENCODE);
+}
+
+/**
+ * @brief process an image file
+ *
+ * The input image is processed by retinex_image() and written to the
+ * output file.
+ *
+ * @param fname_in, fname_out input and output file names
+ * @param t retinex threshold
+ * @param cache solver context cache
+ * @param fmt input and output file formats
+ *
+ * @return 0 on success, -1 on error
+ */
+static int retinex_file(const char *fname_in, const char *fname_out,
+                        float t, retinex_pde_cache_t *cache,
+                        const fmt_t *fmt)
+{
+    size_t nx, ny, nc;          /* image size */
+    float *data;
+    io_raw_t raw;               /* raw input image */
+    int status;
+
+    /* read the image into data */
+    DBG_CLOCK_START(0);
+    if (NULL == (data = image_read(fname_in, fmt, &raw, &nx, &ny, &nc))) {
+        fprintf(stderr, "the image could not be properly read\n");
+        return -1;
+    }
+    DBG_CLOCK_TOGGLE(0);
+
+    status = retinex_image(data, nx, ny, nc, t, cache);
+
+    if (0 == status) {
+        DBG_CLOCK_TOGGLE(0);
+        image_write(fname_out, fmt, data, nx, ny, nc);
+        DBG_CLOCK_TOGGLE(0);
+        DBG_PRINTF1("io\t%0.2fs\n", DBG_CLOCK_S(0));
+    }
+
+    image_free(fmt, &raw, data);
+
+    return status;
+}
+
+/**
+ * @brief process a raw image file by tiles, with bounded memory
+ *
+ * The input file is mapped in memory if it is a planar float file,
+ * and the output, a planar float file, is mapped and written by
+ * tiles, see tile.c.
+ *
+ * @param fname_in, fname_out input and output file names
+ * @param t retinex threshold
+ * @param fmt input and output file formats
+ * @param mem memory cap, in bytes
+ *
+ * @return 0 on success, -1 on error
+ */
+static int retinex_tiled_file(const char *fname_in, const char *fname_out,
+                              float t, const fmt_t *fmt, size_t mem)
+{
+    io_raw_t raw_in, raw_out;
+    size_t nx, ny, nc, c, nc_non_alpha;
+    prof_mark_t mark;
+    int status;
+
+    if (!fmt->raw_in || !fmt->raw_out || IO_RAW_F32 != fmt->type_out) {
+        fprintf(stderr, "the tiled mode needs a raw input "
+                "and a f32 raw output\n");
+        return -1;
+    }
+
+    raw_in.nx = fmt->nx;
+    raw_in.ny = fmt->ny;
+    raw_in.nc = fmt->nc;
+    (void) io_raw_read(&raw_in, fname_in, fmt->type_in);
+    nx = raw_in.nx;
+    ny = raw_in.ny;
+    nc = raw_in.nc;
+    (void) io_raw_create(&raw_out, fname_out, nx, ny, nc, fmt->header_out);
+
+    /* the image has either 1 or 3 non-alpha channels */
+    nc_non_alpha = (3 <= nc ? 3 : 1);
+    status = retinex_tiled(raw_out.data, raw_in.data, nx, ny,
+                           nc_non_alpha, t, mem);
+    if (0 == status) {
+        prof_start(&mark);
+        for (c = 0; c < nc_non_alpha; c++)
+            normalize_mean_dt(raw_out.data + c * nx * ny,
+                              raw_in.data + c * nx * ny, nx * ny);
+        prof_stop(&mark, PROF_NORMALIZE);
+        if (nc > nc_non_alpha)
+            memcpy(raw_out.data + nc_non_alpha * nx * ny,
+                   raw_in.data + nc_non_alpha * nx * ny,
+                   (nc - nc_non_alpha) * nx * ny * sizeof(float));
+    }
+    else
+        fprintf(stderr, "the memory cap is too small for this image\n");
+
+    io_raw_free(&raw_out);
+    io_raw_free(&raw_in);
+
+    return status;
+}
+
+/*
+ * BATCH
+ */
+
+/** batch job, input and output file names */
+typedef struct job_s {
+    char *fname_in;
+    char *fname_out;
+} job_t;
+
+/** duplicate a string, abort() on error */
+static char *str_dup(const char *str)
+{
+    char *dup;
+
+    if (NULL == (dup = (char *) malloc(strlen(str) + 1))) {
+        fprintf(stderr, "allocation error\n");
+        abort();
+    }
+    return strcpy(dup, str);
+}
+
+/** string comparison for qsort() */
+static int str_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * @brief add a job to the list
+ *
+ * Without output file name, the output is the input file base name
+ * in the output directory.
+ */
+static job_t *job_add(job_t *jobs, size_t *njobs, size_t *nalloc,
+                      const char *fname_in, const char *fname_out,
+                      const char *outdir)
+{
+    const char *base;
+
+    if (*njobs == *nalloc) {
+        *nalloc = (0 == *nalloc ? 64 : 2 * *nalloc);
+        if (NULL == (jobs = (job_t *) realloc(jobs,
+                                              *nalloc * sizeof(job_t)))) {
+            fprintf(stderr, "allocation error\n");
+            abort();
+        }
+    }
+    jobs[*njobs].fname_in = str_dup(fname_in);
+    if (NULL != fname_out)
+        jobs[*njobs].fname_out = str_dup(fname_out);
+    else {
+        base = strrchr(fname_in, '/');
+        base = (NULL == base ? fname_in : base + 1);
+        if (NULL == (jobs[*njobs].fname_out = (char *)
+                     malloc(strlen(outdir) + strlen(base) + 2))) {
+            fprintf(stderr, "allocation error\n");
+            abort();
+        }
+        sprintf(jobs[*njobs].fname_out, "%s/%s", outdir, base);
+    }
+    (*njobs)++;
+
+    return jobs;
+}
+
+/**
+ * @brief build the batch job list
+ *
+ * The list is either a directory, and all its .png files are
+ * processed in alphabetical order, or a manifest file, with one
+ * "in.png" or "in.png out.png" item per line.
+ *
+ * @param list directory or manifest file name, "-" means stdin
+ * @param outdir output directory
+ * @param njobs pointer to the number of jobs, filled
+ *
+ * @return the job array, NULL on error
+ */
+static job_t *batch_jobs(const char *list, const char *outdir,
+                         size_t *njobs)
+{
+    job_t *jobs = NULL;
+    size_t nalloc = 0;
+    struct stat st;
+    DIR *dir;
+    struct dirent *ent;
+    char **names = NULL;
+    size_t nnames = 0, i, len;
+    char *path;
+    FILE *fp;
+    char line[2 * FILENAME_MAX + 2];
+    char *fname_in, *fname_out;
+
+    *njobs = 0;
+    if (0 != strcmp(list, "-") && 0 == stat(list, &st)
+        && S_ISDIR(st.st_mode)) {
+        /* directory: every .png file */
+        if (NULL == (dir = opendir(list)))
+            return NULL;
+        while (NULL != (ent = readdir(dir))) {
+            len = strlen(ent->d_name);
+            if (4 >= len || 0 != strcmp(ent->d_name + len - 4, ".png"))
+                continue;
+            if (NULL == (names = (char **) realloc(names, (nnames + 1)
+                                                   * sizeof(char *)))) {
+                fprintf(stderr, "allocation error\n");
+                abort();
+            }
+            names[nnames++] = str_dup(ent->d_name);
+        }
+        (void) closedir(dir);
+        if (0 < nnames)
+            qsort(names, nnames, sizeof(char *), &str_cmp);
+        for (i = 0; i < nnames; i++) {
+            if (NULL == (path = (char *) malloc(strlen(list)
+                                                + strlen(names[i]) + 2))) {
+                fprintf(stderr, "allocation error\n");
+                abort();
+            }
+            sprintf(path, "%s/%s", list, names[i]);
+            jobs = job_add(jobs, njobs, &nalloc, path, NULL, outdir);
+            free(path);
+            free(names[i]);
+        }
+        free(names);
+    }
+    else {
+        /* manifest file */
+        if (0 == strcmp(list, "-"))
+            fp = stdin;
+        else if (NULL == (fp = fopen(list, "r")))
+            return NULL;
+        while (NULL != fgets(line, sizeof(line), fp)) {
+            if (NULL == (fname_in = strtok(line, " \t\r\n")))
+                continue;
+            fname_out = strtok(NULL, " \t\r\n");
+            jobs = job_add(jobs, njobs, &nalloc, fname_in, fname_out,
+                           outdir);
+        }
+        if (stdin != fp)
+            (void) fclose(fp);
+    }
+
+    return jobs;
+}
+
+/**
+ * @brief process a batch of PNG images
+ *
+ * The images are distributed to a pool of workers. Each worker reads,
+ * processes and writes one image at a time, so the decoding, retinex
+ * and encoding steps of different images overlap, and keeps its own
+ * solver contexts for the image sizes it meets.
+ *
+ * @param list directory or manifest file name, see batch_jobs()
+ * @param outdir output directory
+ * @param t retinex threshold
+ * @param nworkers number of workers, with OpenMP
+ * @param fmt input and output file formats
+ *
+ * @return 0 on success, -1 on error
+ */
+static int retinex_batch(const char *list, const char *outdir, float t,
+                         int nworkers, const fmt_t *fmt)
+{
+    job_t *jobs;
+    size_t njobs;
+    long k;
+    long nfail = 0;
+    double elapsed;
+
+    if (NULL == (jobs = batch_jobs(list, outdir, &njobs))) {
+        fprintf(stderr, "the batch list could not be read\n");
+        return -1;
+    }
+
+    elapsed = wall_time();
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nworkers)
+#else
+    (void) nworkers;
+#endif
+    {
+        retinex_pde_cache_t *cache;
+
+        cache = retinex_pde_cache_new(BATCH_CACHE_SIZE);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 1) reduction(+:nfail)
+#endif
+        for (k = 0; k < (long) njobs; k++)
+            if (0 != retinex_file(jobs[k].fname_in, jobs[k].fname_out,
+                                  t, cache, fmt)) {
+                fprintf(stderr, "%s failed\n", jobs[k].fname_in);
+                nfail++;
+            }
+        retinex_pde_cache_free(cache);
+    }
+    elapsed = wall_time() - elapsed;
+
+    fprintf(stderr, "%lu images in %0.2fs, %0.2f images/s\n",
+            (unsigned long) njobs, elapsed,
+            (0. < elapsed ? (double) njobs / elapsed : 0.));
+
+    for (k = 0; k < (long) njobs; k++) {
+        free(jobs[k].fname_in);
+        free(jobs[k].fname_out);
+    }
+    free(jobs);
+
+    return (0 == nfail ? 0 : -1);
+}
+
+/*
+ * VIDEO
+ */
+
+/** video frame sequence, numbered files or a stream */
+typedef struct seq_s {
+    const char *name;           /* file name pattern, or stream name */
+    size_t prefix;              /* pattern length before the number */
+    int width;                  /* zero-padded number width */
+    const char *suffix;         /* pattern after the number */
+    char *fname;                /* current file name */
+    long index;                 /* current frame number */
+    FILE *fp;                   /* stream, NULL for numbered files */
+} seq_t;
+
+/** build the file name of a numbered frame */
+static void seq_name(seq_t *seq, long index)
+{
+    sprintf(seq->fname, "%.*s%0*ld%s", (int) seq->prefix, seq->name,
+            seq->width, index, seq->suffix);
+}
+
+/**
+ * @brief open a frame sequence
+ *
+ * A name with a %d or %0Nd conversion is the pattern of numbered
+ * files, and the other names are a stream of frames, "-" for stdin or
+ * stdout. The pattern is not used as a printf() format, only this
+ * conversion is replaced by the frame number. The input files are
+ * numbered from 0, or from 1 if there is no frame 0, until the first
+ * missing number.
+ *
+ * @param seq sequence, filled
+ * @param name file name pattern or stream name
+ * @param out 0 for the input sequence, 1 for the output sequence
+ *
+ * @return 0 on success, -1 on error
+ */
+static int seq_open(seq_t *seq, const char *name, int out)
+{
+    const char *pct;
+    char *end;
+    struct stat st;
+
+    seq->name = name;
+    seq->index = 0;
+    seq->fname = NULL;
+    seq->fp = NULL;
+
+    if (NULL == (pct = strchr(name, '%'))) {
+        /* stream */
+        if (0 == strcmp(name, "-"))
+            seq->fp = (out ? stdout : stdin);
+        else if (NULL == (seq->fp = fopen(name, out ? "wb" : "rb")))
+            return -1;
+        return 0;
+    }
+
+    /* numbered files, prefix%[0N]dsuffix */
+    seq->prefix = (size_t) (pct - name);
+    seq->width = 0;
+    end = (char *) pct + 1;
+    if ('0' == *end)
+        seq->width = (int) strtol(end, &end, 10);
+    if ('d' != *end || NULL != strchr(end, '%') || 32 < seq->width)
+        return -1;
+    seq->suffix = end + 1;
+    if (NULL == (seq->fname = (char *) malloc(strlen(name) + 64))) {
+        fprintf(stderr, "allocation error\n");
+        abort();
+    }
+    if (!out) {
+        seq_name(seq, 0);
+        if (0 != stat(seq->fname, &st))
+            seq->index = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief close a frame sequence
+ *
+ * @return 0 on success, -1 on a write error
+ */
+static int seq_close(seq_t *seq)
+{
+    int status = 0;
+
+    if (NULL != seq->fp && stdin != seq->fp && stdout != seq->fp)
+        status = (0 == fclose(seq->fp) ? 0 : -1);
+    free(seq->fname);
+    return status;
+}
+
+/**
+ * @brief check the file format of a sequence
+ *
+ * A TIFF file holds a single image, TIFF streams are not supported.
+ *
+ * @param seq input or output sequence
+ * @param fmt input and output file formats
+ * @param out 0 for an input sequence, 1 for an output sequence
+ *
+ * @return 0 on success, -1 for a TIFF stream
+ */
+static int seq_check(const seq_t *seq, const fmt_t *fmt, int out)
+{
+    if (NULL != seq->fp && !(out ? fmt->raw_out : fmt->raw_in)
+        && FMT_TIFF == (out ? fmt->file_out : fmt->file_in)) {
+        fprintf(stderr, "TIFF streams are not supported\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief read the next frame of a sequence
+ *
+ * A stream of raw frames is read in the same image array, released at
+ * the end by io_raw_free(), the other frames are released by
+ * seq_release().
+ *
+ * @param seq input sequence
+ * @param fmt input file format
+ * @param raw raw image, with a NULL array before the first frame
+ * @param nxp, nyp, ncp pointers to the image size, filled
+ *
+ * @return the image array, NULL after the last frame
+ */
+static float *seq_read(seq_t *seq, const fmt_t *fmt, io_raw_t *raw,
+                       size_t *nxp, size_t *nyp, size_t *ncp)
+{
+    struct stat st;
+    float *data;
+    prof_mark_t mark;
+    int c;
+
+    if (NULL == seq->fp) {
+        /* numbered file, until the first missing number */
+        seq_name(seq, seq->index);
+        if (0 != stat(seq->fname, &st))
+            return NULL;
+        seq->index++;
+        return image_read(seq->fname, fmt, raw, nxp, nyp, ncp);
+    }
+
+    prof_start(&mark);
+    if (fmt->raw_in) {
+        if (NULL == raw->data) {
+            raw->nx = fmt->nx;
+            raw->ny = fmt->ny;
+            raw->nc = fmt->nc;
+        }
+        if (NULL == (data = io_raw_read_stream(raw, seq->fp, fmt->type_in,
+                                               0 == fmt->nx)))
+            return NULL;
+        *nxp = raw->nx;
+        *nyp = raw->ny;
+        *ncp = raw->nc;
+    }
+    else {
+        /* nothing left, a normal end of stream */
+        if (EOF == (c = getc(seq->fp)))
+            return NULL;
+        (void) ungetc(c, seq->fp);
+        if (FMT_PFM == fmt->file_in)
+            data = io_pfm_read_stream(seq->fp, nxp, nyp, ncp);
+        else
+            data = io_png_read_flt_stream(seq->fp, nxp, nyp, ncp);
+    }
+    prof_stop(&mark, PROF_DECODE);
+    return data;
+}
+
+/** release a frame read by seq_read() */
+static void seq_release(const seq_t *seq, const fmt_t *fmt, io_raw_t *raw,
+                        float *data)
+{
+    if (NULL == seq->fp)
+        image_free(fmt, raw, data);
+    else if (!fmt->raw_in)
+        free(data);
+}
+
+/**
+ * @brief write the next frame of a sequence
+ *
+ * A stream is flushed after each frame, for the next program of a
+ * pipeline.
+ *
+ * @param seq output sequence
+ * @param fmt output file format
+ * @param data image array
+ * @param nx, ny, nc image size
+ */
+static void seq_write(seq_t *seq, const fmt_t *fmt, const float *data,
+                      size_t nx, size_t ny, size_t nc)
+{
+    prof_mark_t mark;
+
+    if (NULL == seq->fp) {
+        seq_name(seq, seq->index++);
+        image_write(seq->fname, fmt, data, nx, ny, nc);
+        return;
+    }
+    prof_start(&mark);
+    if (fmt->raw_out)
+        io_raw_write_stream(seq->fp, data, nx, ny, nc,
+                            fmt->type_out, fmt->header_out);
+    else if (FMT_PFM == fmt->file_out)
+        io_pfm_write_stream(seq->fp, data, nx, ny, nc);
+    else
+        io_png_write_flt_stream_opt(seq->fp, data, nx, ny, nc,
+                                    fmt->png_opt);
+    (void) fflush(seq->fp);
+    prof_stop(&mark, PROF_ENCODE);
+}
+
+/**
+ * @brief process the frames of a video
+ *
+ * The frames are processed one at a time, as retinex_image(), with a
+ * single solver context and buffers kept from one frame to the next,
+ * and replaced only if the frame size changes. With warm starts, each
+ * frame is solved from the previous one, see
+ * retinex_pde_ctx_warm_start(); they pay off with the multigrid
+ * solver, not with the DCT. The output frames are numbered as the
+ * input frames, or from 0.
+ *
+ * @param in, out input and output sequences, see seq_open()
+ * @param t retinex threshold
+ * @param fmt input and output frame formats
+ * @param warm 1 to use warm starts, 0 otherwise
+ *
+ * @return 0 on success, -1 on error
+ */
+static int retinex_video(const char *in, const char *out, float t,
+                         const fmt_t *fmt, int warm)
+{
+    seq_t seq_in, seq_out;
+    io_raw_t raw;               /* raw input frame */
+    retinex_pde_ctx_t *ctx = NULL;      /* retinex solver context */
+    float *data;
+    norm_stats_t ref[3];        /* input frame statistics */
+    prof_mark_t mark;           /* stage profiling */
+    size_t nx, ny, nc, c, nc_non_alpha;
+    size_t ctx_nx = 0, ctx_ny = 0, ctx_nc = 0;  /* context size */
+    unsigned long nframes = 0;
+    double elapsed;
+    int status = 0;
+
+    if (0 != seq_open(&seq_in, in, 0)) {
+        fprintf(stderr, "the video input could not be opened\n");
+        return -1;
+    }
+    if (0 != seq_open(&seq_out, out, 1)) {
+        fprintf(stderr, "the video output could not be opened\n");
+        (void) seq_close(&seq_in);
+        return -1;
+    }
+    if (0 != seq_check(&seq_in, fmt, 0) || 0 != seq_check(&seq_out, fmt, 1)) {
+        (void) seq_close(&seq_in);
+        (void) seq_close(&seq_out);
+        return -1;
+    }
+    seq_out.index = (NULL == seq_in.fp ? seq_in.index : 0);
+    raw.data = NULL;
+    raw.map = NULL;
+
+    elapsed = wall_time();
+    while (NULL != (data = seq_read(&seq_in, fmt, &raw, &nx, &ny, &nc))) {
+        /* the image has either 1 or 3 non-alpha channels */
+        nc_non_alpha = (3 <= nc ? 3 : 1);
+
+        /* first frame or new size, new context */
+        if (nx != ctx_nx || ny != ctx_ny || nc_non_alpha != ctx_nc) {
+            retinex_pde_ctx_free(ctx);
+            ctx = retinex_pde_ctx_new(nx, ny, nc_non_alpha);
+            retinex_pde_ctx_warm_start(ctx, warm);
+            ctx_nx = nx;
+            ctx_ny = ny;
+            ctx_nc = nc_non_alpha;
+        }
+
+        /* as retinex_image() */
+        prof_start(&mark);
+        for (c = 0; c < nc_non_alpha; c++)
+            norm_stats(ref + c, data + c * nx * ny, nx * ny);
+        prof_stop(&mark, PROF_NORMALIZE);
+        if (NULL == retinex_pde_ctx_run(ctx, data, t)) {
+            fprintf(stderr, "the retinex PDE failed\n");
+            seq_release(&seq_in, fmt, &raw, data);
+            status = -1;
+            break;
+        }
+        prof_start(&mark);
+        for (c = 0; c < nc_non_alpha; c++)
+            normalize_mean_dt_stats(data + c * nx * ny, ref + c, nx * ny);
+        prof_stop(&mark, PROF_NORMALIZE);
+
+        seq_write(&seq_out, fmt, data, nx, ny, nc);
+        seq_release(&seq_in, fmt, &raw, data);
+        nframes++;
+    }
+    elapsed = wall_time() - elapsed;
+
+    if (0 == nframes && 0 == status) {
+        fprintf(stderr, "no video frame could be read\n");
+        status = -1;
+    }
+    fprintf(stderr, "%lu frames in %0.2fs, %0.2f frames/s\n",
+            nframes, elapsed,
+            (0. < elapsed ? (double) nframes / elapsed : 0.));
+
+    if (fmt->raw_in && NULL != seq_in.fp)
+        io_raw_free(&raw);
+    retinex_pde_ctx_free(ctx);
+    (void) seq_close(&seq_in);
+    if (0 != seq_close(&seq_out)) {
+        fprintf(stderr, "the video output could not be written\n");
+        status = -1;
+    }
+
+    return status;
+}
+
+/*
+ * THRESHOLD SWEEP
+ */
+
+/** number of thresholds solved together by the threshold sweep */
+#define SWEEP_GROUP 4
+
+/**
+ * @brief parse a threshold list
+ *
+ * @param str thresholds in [0,1[, separated by commas
+ * @param tp pointer to the threshold array, allocated
+ *
+ * @return the number of thresholds, 0 on error
+ */
+static size_t parse_thresholds(const char *str, float **tp)
+{
+    const char *ptr;
+    char *end;
+    double t;
+    size_t nt;
+
+    /* one more threshold than commas */
+    nt = 1;
+    for (ptr = str; '\0' != *ptr; ptr++)
+        if (',' == *ptr)
+            nt++;
+    if (NULL == (*tp = (float *) malloc(nt * sizeof(float)))) {
+        fprintf(stderr, "allocation error\n");
+        abort();
+    }
+
+    ptr = str;
+    for (nt = 0; '\0' != *ptr; nt++) {
+        t = strtod(ptr, &end);
+        if (end == ptr || 0. > t || 1. <= t
+            || (',' != *end && '\0' != *end)
+            || (',' == *end && '\0' == end[1])) {
+            free(*tp);
+            return 0;
+        }
+        (*tp)[nt] = (float) t;
+        ptr = (',' == *end ? end + 1 : end);
+    }
+    if (0 == nt)
+        free(*tp);
+    return nt;
+}
+
+/**
+ * @brief process an image with several thresholds
+ *
+ * The image is read once, and processed as retinex_image() for every
+ * threshold. The thresholds are solved by groups of SWEEP_GROUP, in
+ * the same solver context, with the input laplacians stacked as the
+ * channels of a single batched DCT, see retinex_pde_ctx_sweep(); the
+ * DCT plans, the Poisson multipliers and the buffers are shared by
+ * all the groups.
+ *
+ * @param fname_in input file name
+ * @param out output sequence, see seq_open(), one image per threshold
+ *        numbered from 0, or a stream
+ * @param t retinex thresholds
+ * @param nt number of thresholds
+ * @param fmt input and output file formats
+ *
+ * @return 0 on success, -1 on error
+ */
+static int retinex_sweep(const char *fname_in, const char *out,
+                         const float *t, size_t nt, const fmt_t *fmt)
+{
+    seq_t seq_out;
+    io_raw_t raw;               /* raw input image */
+    retinex_pde_cache_t *cache;
+    retinex_pde_ctx_t *ctx;     /* retinex solver context */
+    float *data, *rtnx, *img, *frame = NULL;
+    norm_stats_t ref[3];        /* input statistics */
+    prof_mark_t mark;           /* stage profiling */
+    size_t nx, ny, nc, nc_non_alpha, size, ngroup, k, n, j, c;
+    int status = 0;
+
+    if (NULL == (data = image_read(fname_in, fmt, &raw, &nx, &ny, &nc))) {
+        fprintf(stderr, "the image could not be properly read\n");
+        return -1;
+    }
+    if (0 != seq_open(&seq_out, out, 1)) {
+        fprintf(stderr, "the output could not be opened\n");
+        image_free(fmt, &raw, data);
+        return -1;
+    }
+    if (0 != seq_check(&seq_out, fmt, 1)) {
+        (void) seq_close(&seq_out);
+        image_free(fmt, &raw, data);
+        return -1;
+    }
+
+    /* the image has either 1 or 3 non-alpha channels */
+    nc_non_alpha = (3 <= nc ? 3 : 1);
+    size = nx * ny;
+    ngroup = (SWEEP_GROUP < nt ? SWEEP_GROUP : nt);
+    prof_start(&mark);
+    for (c = 0; c < nc_non_alpha; c++)
+        norm_stats(ref + c, data + c * size, size);
+    prof_stop(&mark, PROF_NORMALIZE);
+
+    /* the output images, and their alpha channels */
+    if (NULL == (rtnx = (float *) malloc(ngroup * nc_non_alpha * size
+                                         * sizeof(float)))
+        || (nc > nc_non_alpha
+            && NULL == (frame = (float *) malloc(nc * size
+                                                 * sizeof(float))))) {
+        fprintf(stderr, "allocation error\n");
+        abort();
+    }
+    if (NULL != frame)
+        memcpy(frame + nc_non_alpha * size, data + nc_non_alpha * size,
+               (nc - nc_non_alpha) * size * sizeof(float));
+
+    /* a full group and the last one */
+    cache = retinex_pde_cache_new(2);
+    for (k = 0; k < nt && 0 == status; k += n) {
+        n = (ngroup < nt - k ? ngroup : nt - k);
+        ctx = retinex_pde_cache_get(cache, nx, ny, n * nc_non_alpha);
+        if (NULL == ctx) {
+            fprintf(stderr, "not enough memory for the solver\n");
+            status = -1;
+            break;
+        }
+        if (NULL == retinex_pde_ctx_sweep(ctx, rtnx, data, t + k, n)) {
+            fprintf(stderr, "the retinex PDE failed\n");
+            status = -1;
+            break;
+        }
+        for (j = 0; j < n; j++) {
+            img = rtnx + j * nc_non_alpha * size;
+            prof_start(&mark);
+            for (c = 0; c < nc_non_alpha; c++)
+                normalize_mean_dt_stats(img + c * size, ref + c, size);
+            prof_stop(&mark, PROF_NORMALIZE);
+            if (NULL != frame) {
+                memcpy(frame, img, nc_non_alpha * size * sizeof(float));
+                img = frame;
+            }
+            seq_write(&seq_out, fmt, img, nx, ny, nc);
+        }
+    }
+    retinex_pde_cache_free(cache);
+
+    free(frame);
+    free(rtnx);
+    image_free(fmt, &raw, data);
+    if (0 != seq_close(&seq_out)) {
+        fprintf(stderr, "the output could not be written\n");
+        status = -1;
+    }
+
+    return status;
+}
+
 /**
  * @brief main function call
  */
 int main(int argc, char *const *argv)
 {
     float t;                    /* retinex threshold */
-    size_t nx, ny, nc;          /* image size */
-    size_t channel, nc_non_alpha;
-    float *data, *data_rtnx;
+    const char *wisdom = NULL;  /* FFTW wisdom file */
+    const char *warm = NULL;    /* image sizes to plan */
+    const char *batch = NULL;   /* batch list */
+    const char *sock = NULL;    /* server socket */
+    int video = 0;              /* video mode */
+    int video_warm = 0;         /* video warm starts, multigrid only */
+    int peak_mem = 0;           /* print the peak memory */
+    const char *profile = NULL; /* stage profile file */
+    const char *thresholds = NULL;      /* threshold sweep list */
+    float *ts;                  /* threshold sweep */
+    size_t nt;
+    retinex_pde_cache_t *cache;
+    int plan_set = 0;           /* planning rigor set by -p */
+    int nthreads = 1;           /* number of threads */
+    size_t tile_mem = 0;        /* tiled mode memory cap */
+    fmt_t fmt;                  /* file formats */
+    int i, status;
 
     /* "-v" option : version info */
     if (2 <= argc && 0 == strcmp("-v", argv[1])) {
         fprintf(stdout, "%s version " __DATE__ "\n", argv[0]);
         return EXIT_SUCCESS;
     }
-    /* wrong number of parameters : simple help info */
-    if (4 != argc) {
-        fprintf(stderr, "usage : %s T in.png rtnx.png\n", argv[0]);
-        fprintf(stderr, "        T retinex threshold [0,1[\n");
-        return EXIT_FAILURE;
-    }
 
-    /* retinex threshold */
-    t = atof(argv[1]);
-    if (0. > t || 1. <= t) {
-        fprintf(stderr, "the retinex float threshold must be in [0,1[\n");
-        return EXIT_FAILURE;
+    /* PNG files by default */
+    memset(&fmt, 0, sizeof(fmt));
+
+    /* default number of threads, from the environment */
+    if (NULL != getenv("RETINEX_THREADS"))
+        nthreads = atoi(getenv("RETINEX_THREADS"));
+
+    /* options, before the parameters */
+    for (i = 1; i < argc && '-' == argv[i][0] && '\0' != argv[i][1]; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (0 == strcmp("-p", argv[i])) {
+            i++;
+            if (0 == strcmp("estimate", argv[i]))
+                retinex_pde_plan_rigor(RETINEX_PDE_PLAN_ESTIMATE);
+            else if (0 == strcmp("measure", argv[i]))
+                retinex_pde_plan_rigor(RETINEX_PDE_PLAN_MEASURE);
+            else if (0 == strcmp("patient", argv[i]))
+                retinex_pde_plan_rigor(RETINEX_PDE_PLAN_PATIENT);
+            else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            plan_set = 1;
+        }
+        else if (0 == strcmp("-j", argv[i]))
+            nthreads = atoi(argv[++i]);
+        else if (0 == strcmp("-w", argv[i]))
+            wisdom = argv[++i];
+        else if (0 == strcmp("--pad", argv[i]))
+            retinex_pde_padding(1);
+        else if (0 == strcmp("--solver", argv[i])) {
+            i++;
+            if (0 == strcmp("dct", argv[i])) {
+                retinex_pde_solver(RETINEX_PDE_SOLVER_DCT);
+                video_warm = 0;
+            }
+            else if (0 == strcmp("multigrid", argv[i])) {
+                retinex_pde_solver(RETINEX_PDE_SOLVER_MULTIGRID);
+                video_warm = 1;
+            }
+            else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (0 == strcmp("--tol", argv[i])) {
+            double tol = atof(argv[++i]);
+
+            if (!(0. < tol)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            retinex_pde_tolerance(tol);
+        }
+        else if (0 == strcmp("--precision", argv[i])) {
+            i++;
+            if (0 == strcmp("float", argv[i]))
+                retinex_pde_precision(RETINEX_PDE_PRECISION_FLOAT);
+            else if (0 == strcmp("double", argv[i]))
+                retinex_pde_precision(RETINEX_PDE_PRECISION_DOUBLE);
+            else if (0 == strcmp("long", argv[i]))
+                retinex_pde_precision(RETINEX_PDE_PRECISION_LONG_DOUBLE);
+            else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (0 == strcmp("--tile-mem", argv[i])) {
+            if (0 == (tile_mem = parse_mem(argv[++i]))) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (0 == strcmp("--low-mem", argv[i])) {
+            low_mem = 1;
+            retinex_pde_low_memory(1);
+        }
+        else if (0 == strcmp("--peak-mem", argv[i]))
+            peak_mem = 1;
+        else if (0 == strcmp("--profile", argv[i]))
+            profile = argv[++i];
+        else if (0 == strcmp("--in", argv[i])
+                 || 0 == strcmp("--out", argv[i])) {
+            if (0 != parse_fmt(argv[i + 1], &fmt,
+                               0 == strcmp("--out", argv[i]))) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            i++;
+        }
+        else if (0 == strcmp("--batch", argv[i]))
+            batch = argv[++i];
+        else if (0 == strcmp("--serve", argv[i]))
+            sock = argv[++i];
+        else if (0 == strcmp("--video", argv[i]))
+            video = 1;
+        else if (0 == strcmp("--thresholds", argv[i]))
+            thresholds = argv[++i];
+        else if (0 == strcmp("--warm-wisdom", argv[i]))
+            warm = argv[++i];
+        else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
     }
 
-    /* read the PNG image into data */
-    DBG_CLOCK_START(0);
-    if (NULL == (data = io_png_read_flt(argv[2], &nx, &ny, &nc))) {
-        fprintf(stderr, "the image could not be properly read\n");
+    /* wrong number of parameters : simple help info */
+    if ((NULL == warm && NULL == batch && NULL == sock && NULL == thresholds
+         && 3 != argc - i)
+        || (NULL != batch && (2 != argc - i || NULL != sock
+                              || 0 != tile_mem))
+        || (NULL != sock && (0 != argc - i || NULL != warm
+                             || 0 != tile_mem))
+        || (NULL != warm && (0 != argc - i || NULL == wisdom
+                             || NULL != batch))
+        || (video && (NULL != batch || NULL != sock || NULL != warm
+                      || 0 != tile_mem))
+        || (NULL != thresholds && (2 != argc - i || NULL != batch
+                                   || NULL != sock || NULL != warm
+                                   || video || 0 != tile_mem))) {
+        usage(argv[0]);
         return EXIT_FAILURE;
     }
-    DBG_CLOCK_TOGGLE(0);
 
-    /* allocate data_rtnx and fill it with a copy of data */
-    if (NULL == (data_rtnx = (float *) malloc(nc * nx * ny * sizeof(float)))) {
-        fprintf(stderr, "allocation error\n");
-        free(data);
+    if (1 > nthreads) {
+        fprintf(stderr, "the number of threads must be >= 1\n");
         return EXIT_FAILURE;
     }
-    memcpy(data_rtnx, data, nc * nx * ny * sizeof(float));
+    /* in batch and server modes, the threads are workers */
+    retinex_pde_threads(NULL == batch && NULL == sock ? nthreads : 1);
+    if (NULL != profile)
+        prof_enable(1);
 
-    /* the image has either 1 or 3 non-alpha channels */
-    if (3 <= nc)
-        nc_non_alpha = 3;
-    else
-        nc_non_alpha = 1;
+    /* a missing wisdom file is not an error, it will be created */
+    if (NULL != wisdom)
+        (void) retinex_pde_wisdom_load(wisdom);
 
-    /*
-     * run retinex on each non-alpha channel data_rtnx,
-     * normalize mean and standard deviation and save
-     */
-    for (channel = 0; channel < nc_non_alpha; channel++) {
-        if (NULL == retinex_pde(data_rtnx + channel * nx * ny, nx, ny, t)) {
-            fprintf(stderr, "the retinex PDE failed\n");
-            free(data_rtnx);
-            free(data);
+    if (NULL != warm) {
+        /* planning only, FFTW_ESTIMATE plans are not worth saving */
+        if (!plan_set)
+            retinex_pde_plan_rigor(RETINEX_PDE_PLAN_MEASURE);
+        if (0 != (status = warm_wisdom(warm)))
+            fprintf(stderr, "the image sizes must be WxH or WxHxC\n");
+    }
+    else if (NULL != sock)
+        status = serve(sock, nthreads, &retinex_image);
+    else if (NULL != thresholds) {
+        if (0 == (nt = parse_thresholds(thresholds, &ts))) {
+            fprintf(stderr,
+                    "the retinex float thresholds must be in [0,1[\n");
             return EXIT_FAILURE;
         }
-        normalize_mean_dt(data_rtnx + channel * nx * ny,
-                          data + channel * nx * ny, nx * ny);
+        status = retinex_sweep(argv[i], argv[i + 1], ts, nt, &fmt);
+        free(ts);
+    }
+    else {
+        /* retinex threshold */
+        t = atof(argv[i]);
+        if (0. > t || 1. <= t) {
+            fprintf(stderr,
+                    "the retinex float threshold must be in [0,1[\n");
+            return EXIT_FAILURE;
+        }
+        if (video)
+            status = retinex_video(argv[i + 1], argv[i + 2], t, &fmt,
+                                   video_warm);
+        else if (0 != tile_mem)
+            status = retinex_tiled_file(argv[i + 1], argv[i + 2], t, &fmt,
+                                        tile_mem);
+        else if (NULL != batch)
+            status = retinex_batch(batch, argv[i + 1], t, nthreads,
+                                   &fmt);
+        else {
+            cache = retinex_pde_cache_new(1);
+            status = retinex_file(argv[i + 1], argv[i + 2], t, cache,
+                                  &fmt);
+            retinex_pde_cache_free(cache);
+        }
     }
-    DBG_CLOCK_TOGGLE(0);
-    io_png_write_flt(argv[3], data_rtnx, nx, ny, nc);
-    DBG_CLOCK_TOGGLE(0);
-    DBG_PRINTF1("io\t%0.2fs\n", DBG_CLOCK_S(0));
 
-    free(data_rtnx);
-    free(data);
+    if (NULL != wisdom && 0 == status
+        && 0 == retinex_pde_wisdom_save(wisdom)) {
+        fprintf(stderr, "the FFTW wisdom could not be saved\n");
+        status = -1;
+    }
+    retinex_pde_cleanup();
+
+    if (peak_mem)
+        fprintf(stderr, "peak memory %0.1f MB\n",
+                peak_memory() / (1024. * 1024.));
+    if (NULL != profile && 0 != prof_write(profile)) {
+        fprintf(stderr, "the profile could not be written\n");
+        status = -1;
+    }
 
-    return EXIT_SUCCESS;
+    return (0 == status ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -19,16 +19,26 @@
  * @file retinex_pde_lib.c
  * @brief laplacian, DFT and Poisson routines
  *
+ * The Poisson equation is solved by DCT, or by the multigrid solver
+ * of mg.c, see retinex_pde_solver().
+ *
  * @author Nicolas Limare <nicolas.limare@cmla.ens-cachan.fr>
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <float.h>
 
 #include <fftw3.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "debug.h"
+#include "prof.h"
+#include "mg.h"
 
 /* ensure consistency */
 #include "retinex_pde_lib.h"
@@ -46,10 +56,267 @@
 #endif
 
 /*
- * number of threads to use for libfftw
- * define to enable parallel FFT multi-threading
+ * define FFTW_THREADS to enable the parallel FFTW DCT, and build with
+ * OpenMP for the parallel laplacian and Poisson loops; the number of
+ * threads is set at runtime by retinex_pde_threads()
+ */
+/* #define FFTW_THREADS */
+
+/*
+ * the DCT can also be computed in double and long double precision,
+ * see retinex_pde_precision(); define RETINEX_NO_LONG_DOUBLE to build
+ * without the long double FFTW library
+ */
+
+/*
+ * LAPLACIAN
+ */
+
+/*
+ * SIMD kernels are compiled with the GCC/clang target attribute and
+ * selected at runtime, x86 only; NEON is always available on the
+ * ARM targets defining __ARM_NEON. Define RETINEX_NO_SIMD to only
+ * build the portable code.
+ */
+#ifndef RETINEX_NO_SIMD
+#if (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+     && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define RETINEX_SIMD_X86
+#include <immintrin.h>
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define RETINEX_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif                          /* !RETINEX_NO_SIMD */
+
+/**
+ * @brief laplacian row kernel
+ *
+ * Compute out[k] for k in [0..n[ from the in[k] value and its
+ * in[k - 1], in[k + 1], in_ym1[k] and in_yp1[k] neighbours.
+ */
+typedef void (*laplacian_row_fn) (float *out, const float *in,
+                                  const float *in_ym1, const float *in_yp1,
+                                  size_t n, float t);
+
+/**
+ * @brief thresholded laplacian of one pixel
+ *
+ * The differences are added in the x-1, x+1, y-1, y+1 order, and a
+ * difference below the threshold is skipped. A missing neighbour is
+ * replaced by the pixel itself: the difference is 0 and the result
+ * is exactly the same as if this term was skipped.
+ *
+ * With our compiler and architecture, if() is faster than ( ? : ).
+ *
+ * @param c pixel value
+ * @param xm1, xp1, ym1, yp1 neighbour values
+ * @param t threshold
+ *
+ * @return laplacian value
+ */
+static float laplacian_pixel(float c, float xm1, float xp1,
+                             float ym1, float yp1, float t)
+{
+    float out, diff;
+
+    out = 0.;
+    diff = c - xm1;
+    if (fabs(diff) > t)
+        out += diff;
+    diff = c - xp1;
+    if (fabs(diff) > t)
+        out += diff;
+    diff = c - ym1;
+    if (fabs(diff) > t)
+        out += diff;
+    diff = c - yp1;
+    if (fabs(diff) > t)
+        out += diff;
+
+    return out;
+}
+
+/**
+ * @brief portable laplacian row kernel
+ *
+ * Scalar fallback of the SIMD kernels, without boundary tests.
+ */
+static void laplacian_row_scalar(float *out, const float *in,
+                                 const float *in_ym1, const float *in_yp1,
+                                 size_t n, float t)
+{
+    size_t k;
+
+    for (k = 0; k < n; k++)
+        out[k] = laplacian_pixel(in[k], in[k - 1], in[k + 1],
+                                 in_ym1[k], in_yp1[k], t);
+
+    return;
+}
+
+#ifdef RETINEX_SIMD_X86
+
+/**
+ * @brief AVX2 laplacian row kernel
+ *
+ * Same computation as laplacian_pixel(), 8 pixels at a time, without
+ * branches. The masked differences are replaced by +0 and still
+ * added; the partial sums can never be -0, so x + 0 = x and the
+ * results are bit-identical to the scalar code.
+ */
+__attribute__ ((target("avx2")))
+static void laplacian_row_avx2(float *out, const float *in,
+                               const float *in_ym1, const float *in_yp1,
+                               size_t n, float t)
+{
+    __m256 v_t, v_abs, v_in, v_out, v_diff;
+    size_t k;
+
+    v_t = _mm256_set1_ps(t);
+    /* fabs() is a sign bit mask */
+    v_abs = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+/* add the (c - v) difference if its absolute value is > t */
+#define _LAPLACIAN_AVX2_ADD(V)                                          \
+    v_diff = _mm256_sub_ps(v_in, (V));                                  \
+    v_out = _mm256_add_ps(v_out, _mm256_and_ps(v_diff,                  \
+        _mm256_cmp_ps(_mm256_and_ps(v_diff, v_abs), v_t, _CMP_GT_OQ)));
+
+    for (k = 0; k + 8 <= n; k += 8) {
+        v_in = _mm256_loadu_ps(in + k);
+        v_out = _mm256_setzero_ps();
+        _LAPLACIAN_AVX2_ADD(_mm256_loadu_ps(in + k - 1));
+        _LAPLACIAN_AVX2_ADD(_mm256_loadu_ps(in + k + 1));
+        _LAPLACIAN_AVX2_ADD(_mm256_loadu_ps(in_ym1 + k));
+        _LAPLACIAN_AVX2_ADD(_mm256_loadu_ps(in_yp1 + k));
+        _mm256_storeu_ps(out + k, v_out);
+    }
+#undef _LAPLACIAN_AVX2_ADD
+
+    /* remaining pixels */
+    laplacian_row_scalar(out + k, in + k, in_ym1 + k, in_yp1 + k, n - k, t);
+
+    return;
+}
+
+/**
+ * @brief AVX-512 laplacian row kernel
+ *
+ * Same computation as laplacian_pixel(), 16 pixels at a time, with
+ * the comparison results used as addition masks.
+ */
+__attribute__ ((target("avx512f")))
+static void laplacian_row_avx512(float *out, const float *in,
+                                 const float *in_ym1, const float *in_yp1,
+                                 size_t n, float t)
+{
+    __m512 v_t, v_zero, v_in, v_out, v_diff;
+    __m512i v_abs;
+    __mmask16 mask;
+    size_t k;
+
+    v_t = _mm512_set1_ps(t);
+    v_zero = _mm512_setzero_ps();
+    v_abs = _mm512_set1_epi32(0x7fffffff);
+
+/* add the (c - v) difference if its absolute value is > t, else +0 */
+#define _LAPLACIAN_AVX512_ADD(V)                                        \
+    v_diff = _mm512_sub_ps(v_in, (V));                                  \
+    mask = _mm512_cmp_ps_mask(_mm512_castsi512_ps(_mm512_and_epi32(     \
+        _mm512_castps_si512(v_diff), v_abs)), v_t, _CMP_GT_OQ);         \
+    v_out = _mm512_add_ps(v_out, _mm512_mask_mov_ps(v_zero, mask, v_diff));
+
+    for (k = 0; k + 16 <= n; k += 16) {
+        v_in = _mm512_loadu_ps(in + k);
+        v_out = v_zero;
+        _LAPLACIAN_AVX512_ADD(_mm512_loadu_ps(in + k - 1));
+        _LAPLACIAN_AVX512_ADD(_mm512_loadu_ps(in + k + 1));
+        _LAPLACIAN_AVX512_ADD(_mm512_loadu_ps(in_ym1 + k));
+        _LAPLACIAN_AVX512_ADD(_mm512_loadu_ps(in_yp1 + k));
+        _mm512_storeu_ps(out + k, v_out);
+    }
+#undef _LAPLACIAN_AVX512_ADD
+
+    /* remaining pixels */
+    laplacian_row_scalar(out + k, in + k, in_ym1 + k, in_yp1 + k, n - k, t);
+
+    return;
+}
+
+#endif                          /* RETINEX_SIMD_X86 */
+
+#ifdef RETINEX_SIMD_NEON
+
+/**
+ * @brief NEON laplacian row kernel
+ *
+ * Same computation as laplacian_pixel(), 4 pixels at a time.
+ */
+static void laplacian_row_neon(float *out, const float *in,
+                               const float *in_ym1, const float *in_yp1,
+                               size_t n, float t)
+{
+    float32x4_t v_t, v_in, v_out, v_diff;
+    size_t k;
+
+    v_t = vdupq_n_f32(t);
+
+/* add the (c - v) difference if its absolute value is > t */
+#define _LAPLACIAN_NEON_ADD(V)                                          \
+    v_diff = vsubq_f32(v_in, (V));                                      \
+    v_out = vaddq_f32(v_out, vreinterpretq_f32_u32(vandq_u32(           \
+        vreinterpretq_u32_f32(v_diff),                                  \
+        vcgtq_f32(vabsq_f32(v_diff), v_t))));
+
+    for (k = 0; k + 4 <= n; k += 4) {
+        v_in = vld1q_f32(in + k);
+        v_out = vdupq_n_f32(0.);
+        _LAPLACIAN_NEON_ADD(vld1q_f32(in + k - 1));
+        _LAPLACIAN_NEON_ADD(vld1q_f32(in + k + 1));
+        _LAPLACIAN_NEON_ADD(vld1q_f32(in_ym1 + k));
+        _LAPLACIAN_NEON_ADD(vld1q_f32(in_yp1 + k));
+        vst1q_f32(out + k, v_out);
+    }
+#undef _LAPLACIAN_NEON_ADD
+
+    /* remaining pixels */
+    laplacian_row_scalar(out + k, in + k, in_ym1 + k, in_yp1 + k, n - k, t);
+
+    return;
+}
+
+#endif                          /* RETINEX_SIMD_NEON */
+
+/**
+ * @brief select the best laplacian row kernel for this CPU
+ *
+ * The RETINEX_SIMD environment variable can force a kernel: "scalar",
+ * "avx2", "avx512" or "neon". An unsupported choice falls back to
+ * the best available kernel.
+ *
+ * @return the row kernel
  */
-/* #define FFTW_NTHREADS 4 */
+static laplacian_row_fn laplacian_kernel(void)
+{
+    const char *simd;
+
+    simd = getenv("RETINEX_SIMD");
+    if (NULL != simd && 0 == strcmp(simd, "scalar"))
+        return &laplacian_row_scalar;
+#ifdef RETINEX_SIMD_X86
+    __builtin_cpu_init();
+    if ((NULL == simd || 0 == strcmp(simd, "avx512"))
+        && __builtin_cpu_supports("avx512f"))
+        return &laplacian_row_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return &laplacian_row_avx2;
+#endif                          /* RETINEX_SIMD_X86 */
+#ifdef RETINEX_SIMD_NEON
+    return &laplacian_row_neon;
+#endif                          /* RETINEX_SIMD_NEON */
+    return &laplacian_row_scalar;
+}
 
 /**
  * @brief compute the discrete laplacian of a 2D array with a threshold
@@ -63,29 +330,28 @@
  * If the absolute value of difference is < t, 0 is used instead.
  *
  * This step takes a significant part of the computation time, and
- * needs to be fast. In that case, we observed that (with our compiler
- * and architecture):
- * - pointer arithmetic is faster than data[i]
- * - if() is faster than ( ? : )
+ * needs to be fast. The inner columns of every row are processed by
+ * a branch-free (SIMD) row kernel; on the first and last rows, the
+ * missing y-1 or y+1 neighbour row is the row itself. The first and
+ * last columns, including the corners, are processed pixel by pixel.
  *
  * @param data_out output array
  * @param data_in input array
  * @param nx, ny array size
  * @param t threshold
+ * @param kernel row kernel, from laplacian_kernel()
  *
  * @return data_out
- *
- * @todo split corner/border/inner
  */
 static float *discrete_laplacian_threshold(float *data_out,
                                            const float *data_in,
-                                           size_t nx, size_t ny, float t)
+                                           size_t nx, size_t ny, float t,
+                                           laplacian_row_fn kernel)
 {
-    size_t i, j;
+    size_t j;
     float *ptr_out;
-    float diff;
-    /* pointers to the current and neighbour values */
-    const float *ptr_in, *ptr_in_xm1, *ptr_in_xp1, *ptr_in_ym1, *ptr_in_yp1;
+    /* pointers to the current and neighbour rows */
+    const float *ptr_in, *ptr_in_ym1, *ptr_in_yp1;
 
     /* sanity check */
     if (NULL == data_in || NULL == data_out) {
@@ -95,52 +361,39 @@ static float *discrete_laplacian_threshold(float *data_out,
 
     DBG_CLOCK_TOGGLE(LAPLACE);
 
-    /* pointers to the data and neighbour values */
-    /*
-     *                 y-1
-     *             x-1 ptr x+1
-     *                 y+1
-     *    <---------------------nx------->
-     */
-    ptr_in = data_in;
-    ptr_in_xm1 = data_in - 1;
-    ptr_in_xp1 = data_in + 1;
-    ptr_in_ym1 = data_in - nx;
-    ptr_in_yp1 = data_in + nx;
-    ptr_out = data_out;
-    /* iterate on j, i, following the array order */
+    /* iterate on j, following the array order, in row bands */
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) \
+    private(ptr_in, ptr_in_ym1, ptr_in_yp1, ptr_out)
+#endif
     for (j = 0; j < ny; j++) {
-        for (i = 0; i < nx; i++) {
-            *ptr_out = 0.;
-            /* row differences */
-            if (0 < i) {
-                diff = *ptr_in - *ptr_in_xm1;
-                if (fabs(diff) > t)
-                    *ptr_out += diff;
-            }
-            if (nx - 1 > i) {
-                diff = *ptr_in - *ptr_in_xp1;
-                if (fabs(diff) > t)
-                    *ptr_out += diff;
-            }
-            /* column differences */
-            if (0 < j) {
-                diff = *ptr_in - *ptr_in_ym1;
-                if (fabs(diff) > t)
-                    *ptr_out += diff;
-            }
-            if (ny - 1 > j) {
-                diff = *ptr_in - *ptr_in_yp1;
-                if (fabs(diff) > t)
-                    *ptr_out += diff;
-            }
-            ptr_in++;
-            ptr_in_xm1++;
-            ptr_in_xp1++;
-            ptr_in_ym1++;
-            ptr_in_yp1++;
-            ptr_out++;
+        /*
+         *                 y-1
+         *             x-1 ptr x+1
+         *                 y+1
+         *    <---------------------nx------->
+         */
+        ptr_in = data_in + j * nx;
+        ptr_in_ym1 = (0 < j ? ptr_in - nx : ptr_in);
+        ptr_in_yp1 = (ny - 1 > j ? ptr_in + nx : ptr_in);
+        ptr_out = data_out + j * nx;
+
+        if (1 == nx) {
+            ptr_out[0] = laplacian_pixel(ptr_in[0], ptr_in[0], ptr_in[0],
+                                         ptr_in_ym1[0], ptr_in_yp1[0], t);
+            continue;
         }
+        /* first column */
+        ptr_out[0] = laplacian_pixel(ptr_in[0], ptr_in[0], ptr_in[1],
+                                     ptr_in_ym1[0], ptr_in_yp1[0], t);
+        /* inner columns */
+        kernel(ptr_out + 1, ptr_in + 1, ptr_in_ym1 + 1, ptr_in_yp1 + 1,
+               nx - 2, t);
+        /* last column */
+        ptr_out[nx - 1] = laplacian_pixel(ptr_in[nx - 1], ptr_in[nx - 2],
+                                          ptr_in[nx - 1],
+                                          ptr_in_ym1[nx - 1],
+                                          ptr_in_yp1[nx - 1], t);
     }
 
     DBG_CLOCK_TOGGLE(LAPLACE);
@@ -155,7 +408,8 @@ static float *discrete_laplacian_threshold(float *data_out,
  *
  * @param size the table size
  *
- * @return the table, allocated and filled
+ * @return the table, allocated and filled, NULL if the memory is not
+ * available
  */
 static double *cos_table(size_t size)
 {
@@ -164,10 +418,8 @@ static double *cos_table(size_t size)
     size_t i;
 
     /* allocate the cosinus table */
-    if (NULL == (table = (double *) malloc(sizeof(double) * size))) {
-        fprintf(stderr, "allocation error\n");
-        abort();
-    }
+    if (NULL == (table = (double *) malloc(sizeof(double) * size)))
+        return NULL;
 
     /*
      * fill the cosinus table,
@@ -181,171 +433,1661 @@ static double *cos_table(size_t size)
 }
 
 /**
- * @brief perform a Poisson PDE in the Fourier DCT space
+ * @brief compute the Poisson multiplier table
  *
- * @f$ u(i, j) = F(i, j) * m / (4 - 2 cos(i PI / nx)
- *                              - 2 cos(j PI / ny)) @f$
- * if @f$ (i, j) \neq (0, 0) @f$,
- * @f$ u(0, 0) = 0 @f$
+ * Allocate and fill the nx x ny table of the
+ * @f$ m / (4 - 2 cos(i PI / nx) - 2 cos(j PI / ny)) @f$
+ * multipliers, with 0 at (0, 0).
  *
- * When this function is successively used on arrays of identical
- * size, the trigonometric computation is redundant and could be kept
- * in memory for a faster code. However, in our use case, the speedup
- * is marginal and we prefer to recompute this data and keep the code
- * simple.
+ * The table only depends on the array size and is kept in the solver
+ * context. It is computed row by row, without division or modulo of
+ * the pixel index, and the inner loop can be vectorized. The
+ * multipliers are stored in double precision to get exactly the
+ * same results as a direct computation.
  *
- * @param data the dct complex coefficients, of size nx x ny
  * @param nx, ny data array size
  * @param m global multiplication parameter (DCT normalization)
  *
- * @return the data array, updated
+ * @return the table, allocated and filled, NULL if the memory is not
+ * available
  */
-static float *retinex_poisson_dct(float *data, size_t nx, size_t ny, double m)
+static double *poisson_table(size_t nx, size_t ny, double m)
 {
-    double *cosx = NULL, *cosy = NULL;
-    size_t i;
-    double m2;
-
-    DBG_CLOCK_TOGGLE(POISSON);
+    double *table, *cosx, *cosy;
+    double *ptr_table;
+    double m2, cy;
+    size_t i, j;
 
     /*
      * get the cosinus tables
      * cosx[i] = cos(i Pi / nx) for i in [0..nx[
      * cosy[i] = cos(i Pi / ny) for i in [0..ny[
+     * then store 2 - cosx[i] in cosx
      */
+    table = (double *) malloc(sizeof(double) * nx * ny);
     cosx = cos_table(nx);
     cosy = cos_table(ny);
+    if (NULL == table || NULL == cosx || NULL == cosy) {
+        free(table);
+        free(cosx);
+        free(cosy);
+        return NULL;
+    }
+    for (i = 0; i < nx; i++)
+        cosx[i] = 2. - cosx[i];
 
     /*
-     * we will now multiply data[i, j] by
-     * m / (4 - 2 * cosx[i] - 2 * cosy[j]))
-     * and set data[0, 0] to 0
+     * table[i, j] = m / (4 - 2 * cosx[i] - 2 * cosy[j]))
+     * by construction, we always have cosx[] + cosy[] != 2.,
+     * except for table[0, 0]
      */
     m2 = m / 2.;
-    /*
-     * handle the first value, data[0, 0] = 0
-     * after that, by construction, we always have
-     * cosx[] + cosy[] != 2.
-     */
-    data[0] = 0.;
-    /*
-     * continue with all the array:
-     * i % nx is the position on the x axis (column number)
-     * i / nx is the position on the y axis (row number)
-     */
-    for (i = 1; i < nx * ny; i++)
-        data[i] *= m2 / (2. - cosx[i % nx] - cosy[i / nx]);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) private(i, ptr_table, cy)
+#endif
+    for (j = 0; j < ny; j++) {
+        ptr_table = table + j * nx;
+        cy = cosy[j];
+        for (i = 0; i < nx; i++)
+            ptr_table[i] = m2 / (cosx[i] - cy);
+    }
+    table[0] = 0.;
 
     free(cosx);
     free(cosy);
 
+    return table;
+}
+
+/**
+ * @brief perform a Poisson PDE in the Fourier DCT space
+ *
+ * @f$ u(i, j) = F(i, j) * m / (4 - 2 cos(i PI / nx)
+ *                              - 2 cos(j PI / ny)) @f$
+ * if @f$ (i, j) \neq (0, 0) @f$,
+ * @f$ u(0, 0) = 0 @f$
+ *
+ * The multipliers are precomputed by poisson_table(), this is a
+ * simple streaming multiplication. The nc channels are processed row
+ * by row, to read each table row from the cache for every channel.
+ *
+ * @param data the dct complex coefficients, nc arrays of size nx x ny
+ * @param table multiplier table, of size nx x ny
+ * @param nx, ny data array size
+ * @param nc number of channels
+ *
+ * @return the data array, updated
+ */
+static float *retinex_poisson_dct(float *data, const double *table,
+                                  size_t nx, size_t ny, size_t nc)
+{
+    float *ptr_data;
+    const double *ptr_table;
+    size_t i, j, c;
+
+    DBG_CLOCK_TOGGLE(POISSON);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) \
+    private(i, c, ptr_data, ptr_table)
+#endif
+    for (j = 0; j < ny; j++) {
+        ptr_table = table + j * nx;
+        for (c = 0; c < nc; c++) {
+            ptr_data = data + c * nx * ny + j * nx;
+            for (i = 0; i < nx; i++)
+                ptr_data[i] *= ptr_table[i];
+        }
+    }
+    /*
+     * data[0, 0] = 0,
+     * even if the multiplication by 0 gave -0 or NaN
+     */
+    for (c = 0; c < nc; c++)
+        data[c * nx * ny] = 0.;
+
+    DBG_CLOCK_TOGGLE(POISSON);
+
+    return data;
+}
+
+/**
+ * @brief perform a Poisson PDE in the Fourier DCT space, without table
+ *
+ * Same as retinex_poisson_dct(), with the multipliers computed on the
+ * fly as in poisson_table(), for the same result without the nx x ny
+ * table, at the cost of one division per value.
+ *
+ * @param data the dct complex coefficients, nc arrays of size nx x ny
+ * @param cosx, cosy tables of 2 - cos(i PI / nx) and cos(j PI / ny)
+ * @param m global multiplication parameter (DCT normalization)
+ * @param nx, ny data array size
+ * @param nc number of channels
+ *
+ * @return the data array, updated
+ */
+static float *retinex_poisson_dct_cos(float *data, const double *cosx,
+                                      const double *cosy, double m,
+                                      size_t nx, size_t ny, size_t nc)
+{
+    float *ptr_data;
+    double m2, cy;
+    size_t i, j, c;
+
+    DBG_CLOCK_TOGGLE(POISSON);
+
+    m2 = m / 2.;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) private(i, c, ptr_data, cy)
+#endif
+    for (j = 0; j < ny; j++) {
+        cy = cosy[j];
+        for (c = 0; c < nc; c++) {
+            ptr_data = data + c * nx * ny + j * nx;
+            for (i = 0; i < nx; i++)
+                ptr_data[i] *= m2 / (cosx[i] - cy);
+        }
+    }
+    /* data[0, 0] = 0, the multiplier is not defined */
+    for (c = 0; c < nc; c++)
+        data[c * nx * ny] = 0.;
+
     DBG_CLOCK_TOGGLE(POISSON);
 
     return data;
 }
 
 /*
- * RETINEX
+ * MULTI-THREADING
  */
 
+#ifdef FFTW_THREADS
+/** FFTW threads initialisation flag */
+static int _fftw_threads = 0;
+#endif
+
 /**
- * @brief retinex PDE implementation
- *
- * This function solves the Retinex PDE equation with forward and
- * backward DCT.
- *
- * The input array is processed as follow:
+ * @brief set the number of threads
  *
- * @li a discrete laplacian is computed with a threshold;
- * @li this discrete laplacian array is symmetrised in both directions;
- * @li this data is transformed by forward DFT (both steps can be
- *     handled by a simple DCT);
- * @li the DFT data is modified by
- * @f$ \hat{u}(i, j) = \frac{\hat{F}(i, j)}
- *                           {4 - 2 \cos(\frac{i \pi}{n_x})
- *                           - 2 \cos(\frac{j \pi}{n_y})} @f$;
- * @li this data is transformed by backward DFT.
+ * The FFTW threads are initialised on the first call. The number of
+ * threads is used by the DCT plans of the solver contexts created
+ * afterwards, and by the OpenMP parallel loops. Without FFTW_THREADS
+ * and OpenMP, this function does nothing.
  *
- * @param data input/output array
- * @param nx, ny dimension
- * @param t retinex threshold
+ * This setting must not be changed concurrently with
+ * retinex_pde_ctx_new().
  *
- * @return data, or NULL if an error occured
+ * @param nthreads number of threads, >= 1
  */
-float *retinex_pde(float *data, size_t nx, size_t ny, float t)
+void retinex_pde_threads(int nthreads)
 {
-    fftwf_plan dct_fw, dct_bw;
-    float *data_fft, *data_tmp;
-
-    DBG_CLOCK_RESET(LAPLACE);
-    DBG_CLOCK_RESET(POISSON);
-    DBG_CLOCK_RESET(FOURIER);
-
-    /* check allocaton */
-    if (NULL == data) {
-        fprintf(stderr, "a pointer is NULL and should not be so\n");
+    if (1 > nthreads) {
+        fprintf(stderr, "the number of threads must be >= 1\n");
         abort();
     }
 
-    /* allocate the float tmp array */
-    if (NULL == (data_tmp = (float *) fftwf_malloc(sizeof(float) * nx * ny))) {
-        fprintf(stderr, "allocation error\n");
-        abort();
+#ifdef FFTW_THREADS
+    if (!_fftw_threads) {
+        if (0 == fftwf_init_threads() || 0 == fftw_init_threads()
+#ifndef RETINEX_NO_LONG_DOUBLE
+            || 0 == fftwl_init_threads()
+#endif
+            ) {
+            fprintf(stderr, "fftw initialisation error\n");
+            abort();
+        }
+        _fftw_threads = 1;
     }
+    fftwf_plan_with_nthreads(nthreads);
+    fftw_plan_with_nthreads(nthreads);
+#ifndef RETINEX_NO_LONG_DOUBLE
+    fftwl_plan_with_nthreads(nthreads);
+#endif
+#endif                          /* FFTW_THREADS */
+#ifdef _OPENMP
+    omp_set_num_threads(nthreads);
+#endif                          /* _OPENMP */
 
-    /* compute the laplacian : data -> data_tmp */
-    (void) discrete_laplacian_threshold(data_tmp, data, nx, ny, t);
+    return;
+}
 
-    /* allocate the float-complex FFT array */
-    if (NULL == (data_fft = (float *) fftwf_malloc(sizeof(float) * nx * ny))) {
-        fprintf(stderr, "allocation error\n");
-        abort();
-    }
+/*
+ * DCT PLANNING
+ */
 
-    /* start threaded fftw if FFTW_NTHREADS is defined */
-#ifdef FFTW_NTHREADS
-    if (0 == fftwf_init_threads()) {
-        fprintf(stderr, "fftw initialisation error\n");
+/** FFTW planner flags used for the new solver contexts */
+static unsigned _plan_flags = FFTW_ESTIMATE;
+
+/**
+ * @brief set the DCT planning rigor
+ *
+ * With RETINEX_PDE_PLAN_MEASURE or RETINEX_PDE_PLAN_PATIENT, FFTW
+ * measures the speed of many algorithms when a context is created,
+ * which takes time but gives faster transforms. The choice is saved
+ * in the FFTW wisdom, see retinex_pde_wisdom_save().
+ *
+ * This setting is used by the contexts created afterwards, and must
+ * not be changed concurrently with retinex_pde_ctx_new().
+ *
+ * @param plan planning rigor
+ */
+void retinex_pde_plan_rigor(retinex_pde_plan_t plan)
+{
+    switch (plan) {
+    case RETINEX_PDE_PLAN_ESTIMATE:
+        _plan_flags = FFTW_ESTIMATE;
+        break;
+    case RETINEX_PDE_PLAN_MEASURE:
+        _plan_flags = FFTW_MEASURE;
+        break;
+    case RETINEX_PDE_PLAN_PATIENT:
+        _plan_flags = FFTW_PATIENT;
+        break;
+    default:
+        fprintf(stderr, "unknown planning rigor\n");
         abort();
     }
-    fftwf_plan_with_nthreads(FFTW_NTHREADS);
-#endif                          /* FFTW_NTHREADS */
 
-    /* create the DFT forward plan and run the DCT : data_tmp -> data_fft */
-    DBG_CLOCK_TOGGLE(FOURIER);
-    dct_fw = fftwf_plan_r2r_2d((int) ny, (int) nx,
-                               data_tmp, data_fft,
-                               FFTW_REDFT10, FFTW_REDFT10,
-                               FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
-    fftwf_execute(dct_fw);
-    DBG_CLOCK_TOGGLE(FOURIER);
-    fftwf_free(data_tmp);
+    return;
+}
 
-    /* solve the Poisson PDE in Fourier space */
-    /* 1. / (float) (nx * ny)) is the DCT normalisation term, see libfftw */
-    (void) retinex_poisson_dct(data_fft, nx, ny, 1. / (double) (nx * ny));
+/** pad the new solver contexts to FFT-friendly sizes */
+static int _padding = 0;
 
-    /* create the DFT backward plan and run the iDCT : data_fft -> data */
-    DBG_CLOCK_TOGGLE(FOURIER);
-    dct_bw = fftwf_plan_r2r_2d((int) ny, (int) nx,
-                               data_fft, data,
-                               FFTW_REDFT01, FFTW_REDFT01,
-                               FFTW_ESTIMATE | FFTW_DESTROY_INPUT);
-    fftwf_execute(dct_bw);
-    DBG_CLOCK_TOGGLE(FOURIER);
+/**
+ * @brief enable the padding to FFT-friendly sizes
+ *
+ * FFTW is fast for sizes with small prime factors, and much slower
+ * when a dimension has a large prime factor. With padding, the solver
+ * contexts are created for the next 2^a 3^b 5^c 7^d size, the images
+ * are extended by symmetry to this size before the laplacian, and the
+ * result is cropped.
+ *
+ * The extended image has the same thresholded laplacian as the
+ * original one on the original domain, and the padded Neumann
+ * problem is solved exactly. But the extension adds its own
+ * laplacian outside the domain, so the result differs from the
+ * unpadded one by a discrete harmonic function on the domain. This
+ * difference is smooth and, by the maximum principle, bounded by its
+ * values on the padded edges. After normalization, on the data/
+ * images (padded from 383 to 384, 341 to 343, 764x591 to 768x600),
+ * it is at most 1.6/255, 0.3/255 on average, and up to 2 levels after
+ * 8bit quantization.
+ *
+ * This setting is used by the contexts created afterwards, and must
+ * not be changed concurrently with retinex_pde_ctx_new().
+ *
+ * @param padding 1 to pad, 0 to use the exact image size (default)
+ */
+void retinex_pde_padding(int padding)
+{
+    _padding = padding;
 
-    /* cleanup */
-    fftwf_destroy_plan(dct_fw);
-    fftwf_destroy_plan(dct_bw);
-    fftwf_free(data_fft);
-    fftwf_cleanup();
-#ifdef FFTW_NTHREADS
-    fftwf_cleanup_threads();
-#endif                          /* FFTW_NTHREADS */
+    return;
+}
 
-    DBG_PRINTF1("laplace\t%0.2fs\n", DBG_CLOCK_S(LAPLACE));
-    DBG_PRINTF1("poisson\t%0.2fs\n", DBG_CLOCK_S(POISSON));
-    DBG_PRINTF1("fourier\t%0.2fs\n", DBG_CLOCK_S(FOURIER));
+/** memory-minimal new solver contexts */
+static int _low_memory = 0;
 
-    return data;
+/**
+ * @brief enable the memory-minimal solver contexts
+ *
+ * A DCT context normally has two work arrays, for the laplacians and
+ * for their DCT, and a table of the nx x ny Poisson multipliers in
+ * double precision: 8 bytes per pixel and 8 per pixel and channel.
+ * With this setting, the DCT is computed in place in a single work
+ * array, and the multipliers are computed on the fly from two
+ * cosinus tables, for 4 bytes per pixel and channel. The Poisson
+ * step is slower, with a division per value, and the padding of
+ * retinex_pde_padding() is not used, it would need a second array.
+ * The result is the same, up to the rounding differences between
+ * the in-place and out-of-place FFTW algorithms.
+ *
+ * For the least memory, the channels of an image can also be
+ * processed one at a time, with a single channel context.
+ *
+ * This setting is used by the contexts created afterwards, and must
+ * not be changed concurrently with retinex_pde_ctx_new().
+ *
+ * @param low 1 for the memory-minimal contexts, 0 otherwise (default)
+ */
+void retinex_pde_low_memory(int low)
+{
+    _low_memory = low;
+
+    return;
+}
+
+/**
+ * @brief next FFT-friendly size
+ *
+ * @return the smallest 2^a 3^b 5^c 7^d integer >= n, which is < 2n
+ */
+static size_t fft_size(size_t n)
+{
+    size_t m, k;
+
+    for (;; n++) {
+        m = n;
+        for (k = 2; k <= 7; k++)
+            while (0 == m % k)
+                m /= k;
+        if (1 >= m)
+            return n;
+    }
+}
+
+/*
+ * SOLVER
+ */
+
+/** Poisson solver used by the new solver contexts */
+static retinex_pde_solver_t _solver = RETINEX_PDE_SOLVER_DCT;
+/** multigrid tolerance used by the new solver contexts */
+static double _tolerance = 1E-4;
+
+/**
+ * @brief select the Poisson solver
+ *
+ * The DCT solver is exact, up to the float rounding, and needs the
+ * whole array at once. The multigrid solver (see mg.c) is iterative:
+ * it stops at the tolerance set by retinex_pde_tolerance(), and can
+ * start from the previous solution of its context, see
+ * retinex_pde_ctx_warm_start(). It works on any array size, ignores
+ * retinex_pde_padding() and does not use FFTW.
+ *
+ * This setting is used by the contexts created afterwards, and must
+ * not be changed concurrently with retinex_pde_ctx_new().
+ *
+ * @param solver Poisson solver
+ */
+void retinex_pde_solver(retinex_pde_solver_t solver)
+{
+    if (RETINEX_PDE_SOLVER_DCT != solver
+        && RETINEX_PDE_SOLVER_MULTIGRID != solver) {
+        fprintf(stderr, "unknown solver\n");
+        abort();
+    }
+    _solver = solver;
+
+    return;
+}
+
+/**
+ * @brief set the multigrid solver tolerance
+ *
+ * The multigrid iterations stop when the norm of the residual is
+ * below tol times the norm of the laplacian. With the default 1E-4,
+ * on the data/ images, this takes 3 V-cycles and the normalized
+ * result differs from the DCT result by at most 0.4/255, and up to 1
+ * level after 8bit quantization.
+ *
+ * This setting is used by the contexts created afterwards, and must
+ * not be changed concurrently with retinex_pde_ctx_new().
+ *
+ * @param tol relative tolerance, > 0
+ */
+void retinex_pde_tolerance(double tol)
+{
+    if (!(0. < tol)) {
+        fprintf(stderr, "the tolerance must be > 0\n");
+        abort();
+    }
+    _tolerance = tol;
+
+    return;
+}
+
+/** DCT precision used by the new solver contexts */
+static retinex_pde_precision_t _precision = RETINEX_PDE_PRECISION_FLOAT;
+
+/**
+ * @brief select the DCT precision
+ *
+ * By default, the DCT and the Poisson step are computed in float,
+ * with a relative round-off error growing with the image size. With
+ * the double or long double precision, the images and the laplacians
+ * are still float arrays, but the DCT contexts convert the laplacians
+ * to a work array of the wider type, and compute the DCT, the Poisson
+ * step and the inverse DCT in this precision, before rounding the
+ * solution back to float. The Poisson multipliers are computed in
+ * double. The wider transforms are about 2x (double) and 10x (long
+ * double, without SIMD) slower than the float ones, use twice or four
+ * times the work memory, and do not use retinex_pde_padding() or
+ * retinex_pde_low_memory(). Their FFTW wisdom is not saved by
+ * retinex_pde_wisdom_save(). See bench.c for the accuracy and speed
+ * per image size.
+ *
+ * This setting is used by the contexts created afterwards, and must
+ * not be changed concurrently with retinex_pde_ctx_new(). It has no
+ * effect on the multigrid solver.
+ *
+ * @param precision DCT precision; without long double support, see
+ *        RETINEX_NO_LONG_DOUBLE, the long double precision is
+ *        replaced by double
+ */
+void retinex_pde_precision(retinex_pde_precision_t precision)
+{
+    switch (precision) {
+    case RETINEX_PDE_PRECISION_FLOAT:
+    case RETINEX_PDE_PRECISION_DOUBLE:
+        break;
+    case RETINEX_PDE_PRECISION_LONG_DOUBLE:
+#ifdef RETINEX_NO_LONG_DOUBLE
+        fprintf(stderr, "no long double support, using double\n");
+        precision = RETINEX_PDE_PRECISION_DOUBLE;
+#endif
+        break;
+    default:
+        fprintf(stderr, "unknown precision\n");
+        abort();
+    }
+    _precision = precision;
+
+    return;
+}
+
+/**
+ * @brief load the FFTW wisdom from a file
+ *
+ * The wisdom is added to the current one. Load it before creating
+ * the solver contexts, planning is then almost immediate for the
+ * sizes already measured.
+ *
+ * @param fname wisdom file name
+ *
+ * @return 1 on success, 0 if the file could not be read
+ */
+int retinex_pde_wisdom_load(const char *fname)
+{
+    if (NULL == fname) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
+    }
+
+    return fftwf_import_wisdom_from_filename(fname);
+}
+
+/**
+ * @brief save the FFTW wisdom to a file
+ *
+ * The wisdom is forgotten by retinex_pde_cleanup(), save it before.
+ *
+ * @param fname wisdom file name
+ *
+ * @return 1 on success, 0 if the file could not be written
+ */
+int retinex_pde_wisdom_save(const char *fname)
+{
+    if (NULL == fname) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
+    }
+
+    return fftwf_export_wisdom_to_filename(fname);
+}
+
+/*
+ * SOLVER CONTEXT
+ */
+
+/**
+ * @brief retinex PDE solver context
+ *
+ * Everything that only depends on the image size is kept here and
+ * reused by successive retinex_pde_ctx_run() calls: the DCT plans,
+ * the Poisson multipliers and the work arrays. A context processes nc
+ * channels at once, with a single batched DCT plan. A multigrid
+ * context only has the laplacian work array and the multigrid solver.
+ * A double or long double DCT context has the float laplacian work
+ * array, and a wider work array transformed in place.
+ */
+struct retinex_pde_ctx_s {
+    size_t nx, ny;              /**< array size */
+    size_t nc;                  /**< number of channels */
+    size_t px, py;              /**< DCT size, padded or nx, ny */
+    float *data_tmp;            /**< laplacian work array */
+    float *data_fft;            /**< DCT work array, data_tmp if in place */
+    double *poisson;            /**< Poisson multiplier table, or NULL */
+    double *cosx, *cosy;        /**< Poisson multiplier terms, or NULL */
+    fftwf_plan dct_fw;          /**< forward DCT, data_tmp -> data_fft */
+    fftwf_plan dct_bw;          /**< backward DCT, data_fft -> data_tmp */
+    laplacian_row_fn laplacian; /**< laplacian row kernel */
+    retinex_pde_solver_t solver; /**< Poisson solver */
+    mg_t *mg;                   /**< multigrid solver, or NULL */
+    double tol;                 /**< multigrid tolerance */
+    int warm;                   /**< warm start */
+    float *prev_rhs;            /**< DCT warm start, previous laplacians */
+    float *prev_out;            /**< DCT warm start, previous solution */
+    int prev;                   /**< previous laplacians and solution set */
+    retinex_pde_precision_t precision;  /**< DCT precision */
+    void *work;                 /**< wider DCT work array, or NULL */
+    void *work_fw, *work_bw;    /**< wider DCT plans, in place on work */
+};
+
+/*
+ * WIDER DCT
+ *
+ * The double and long double DCT steps are the same code, for the
+ * REAL type and the X() FFTW prefix, written once as type-generic
+ * macros as in io_png.c, and expanded for each precision. The
+ * conversions are serial, the DCT uses the FFTW threads.
+ */
+
+/** type-generic wider work array and DCT plans setup code */
+#define _CTX_WIDE_NEW(REAL, X) do {                                     \
+        REAL *work;                                                     \
+        if (NULL == (work = (REAL *) X##malloc(sizeof(REAL) * ctx->px  \
+                                               * ctx->py * ctx->nc)))   \
+            break;                                                      \
+        ctx->work = work;                                               \
+        ctx->work_fw = X##plan_many_r2r(2, n, (int) ctx->nc,           \
+                                        work, NULL, 1, n[0] * n[1],     \
+                                        work, NULL, 1, n[0] * n[1],     \
+                                        kind_fw, _plan_flags);          \
+        ctx->work_bw = X##plan_many_r2r(2, n, (int) ctx->nc,           \
+                                        work, NULL, 1, n[0] * n[1],     \
+                                        work, NULL, 1, n[0] * n[1],     \
+                                        kind_bw, _plan_flags);          \
+    } while (0)
+
+/** type-generic wider work array and DCT plans cleanup code */
+#define _CTX_WIDE_FREE(X) do {                                          \
+        X##destroy_plan((X##plan) ctx->work_fw);                        \
+        X##destroy_plan((X##plan) ctx->work_bw);                        \
+        X##free(ctx->work);                                             \
+    } while (0)
+
+/** type-generic conversion and forward DCT code */
+#define _CTX_WIDE_FW(REAL, X) do {                                      \
+        REAL *work = (REAL *) ctx->work;                                \
+        for (i = 0; i < size; i++)                                      \
+            work[i] = (REAL) ctx->data_tmp[i];                          \
+        X##execute((X##plan) ctx->work_fw);                             \
+    } while (0)
+
+/** type-generic Poisson step code, see retinex_poisson_dct() */
+#define _CTX_WIDE_POISSON(REAL) do {                                    \
+        REAL *work;                                                     \
+        const double *table;                                            \
+        for (j = 0; j < ctx->py; j++) {                                 \
+            table = ctx->poisson + j * ctx->px;                         \
+            for (c = 0; c < ctx->nc; c++) {                             \
+                work = (REAL *) ctx->work + (c * ctx->py + j) * ctx->px; \
+                for (i = 0; i < ctx->px; i++)                           \
+                    work[i] *= (REAL) table[i];                         \
+            }                                                           \
+        }                                                               \
+        for (c = 0; c < ctx->nc; c++)                                   \
+            ((REAL *) ctx->work)[c * ctx->px * ctx->py] = 0.;           \
+    } while (0)
+
+/** type-generic backward DCT and conversion code */
+#define _CTX_WIDE_BW(REAL, X) do {                                      \
+        const REAL *work = (const REAL *) ctx->work;                    \
+        X##execute((X##plan) ctx->work_bw);                             \
+        for (i = 0; i < size; i++)                                      \
+            data[i] = (float) work[i];                                  \
+    } while (0)
+
+/**
+ * @brief setup the wider work array and DCT plans of a context
+ *
+ * @param ctx solver context, with the DCT size and precision set
+ * @param n DCT dimensions, ny and nx
+ * @param kind_fw, kind_bw forward and backward DCT kinds
+ *
+ * @return 0 on success, -1 if the memory is not available
+ */
+static int ctx_wide_new(retinex_pde_ctx_t *ctx, int *n,
+                         fftw_r2r_kind *kind_fw, fftw_r2r_kind *kind_bw)
+{
+#ifdef _OPENMP
+#pragma omp critical (retinex_pde_fftw)
+#endif
+    {
+#ifndef RETINEX_NO_LONG_DOUBLE
+        if (RETINEX_PDE_PRECISION_LONG_DOUBLE == ctx->precision)
+            _CTX_WIDE_NEW(long double, fftwl_);
+        else
+#endif
+            _CTX_WIDE_NEW(double, fftw_);
+    }
+    if (NULL == ctx->work)
+        return -1;
+    if (NULL == ctx->work_fw || NULL == ctx->work_bw) {
+        fprintf(stderr, "fftw planning error\n");
+        abort();
+    }
+    return 0;
+}
+
+/**
+ * @brief free the wider work array and DCT plans of a context
+ */
+static void ctx_wide_free(retinex_pde_ctx_t *ctx)
+{
+#ifdef _OPENMP
+#pragma omp critical (retinex_pde_fftw)
+#endif
+    {
+#ifndef RETINEX_NO_LONG_DOUBLE
+        if (RETINEX_PDE_PRECISION_LONG_DOUBLE == ctx->precision)
+            _CTX_WIDE_FREE(fftwl_);
+        else
+#endif
+            _CTX_WIDE_FREE(fftw_);
+    }
+}
+
+/**
+ * @brief wider forward DCT, from the float laplacians
+ */
+static void ctx_wide_fw(retinex_pde_ctx_t *ctx)
+{
+    size_t i, size;
+
+    size = ctx->px * ctx->py * ctx->nc;
+    DBG_CLOCK_TOGGLE(FOURIER);
+#ifndef RETINEX_NO_LONG_DOUBLE
+    if (RETINEX_PDE_PRECISION_LONG_DOUBLE == ctx->precision)
+        _CTX_WIDE_FW(long double, fftwl_);
+    else
+#endif
+        _CTX_WIDE_FW(double, fftw_);
+    DBG_CLOCK_TOGGLE(FOURIER);
+}
+
+/**
+ * @brief wider Poisson step
+ */
+static void ctx_wide_poisson(retinex_pde_ctx_t *ctx)
+{
+    size_t i, j, c;
+
+    DBG_CLOCK_TOGGLE(POISSON);
+#ifndef RETINEX_NO_LONG_DOUBLE
+    if (RETINEX_PDE_PRECISION_LONG_DOUBLE == ctx->precision)
+        _CTX_WIDE_POISSON(long double);
+    else
+#endif
+        _CTX_WIDE_POISSON(double);
+    DBG_CLOCK_TOGGLE(POISSON);
+}
+
+/**
+ * @brief wider backward DCT, into the float output array
+ */
+static void ctx_wide_bw(retinex_pde_ctx_t *ctx, float *data)
+{
+    size_t i, size;
+
+    size = ctx->nx * ctx->ny * ctx->nc;
+    DBG_CLOCK_TOGGLE(FOURIER);
+#ifndef RETINEX_NO_LONG_DOUBLE
+    if (RETINEX_PDE_PRECISION_LONG_DOUBLE == ctx->precision)
+        _CTX_WIDE_BW(long double, fftwl_);
+    else
+#endif
+        _CTX_WIDE_BW(double, fftw_);
+    DBG_CLOCK_TOGGLE(FOURIER);
+}
+
+/**
+ * @brief allocate and setup a retinex PDE solver context
+ *
+ * The DCT plans are created once here, with the rigor set by
+ * retinex_pde_plan_rigor(). The FFTW planner is not thread-safe: the
+ * planning is serialized between OpenMP threads, but this function
+ * must not be called concurrently from other threads.
+ *
+ * The arrays processed with this context are made of nc contiguous
+ * channels of size nx x ny (RRR GGG BBB). With retinex_pde_padding(),
+ * the DCT and the work arrays have a larger, FFT-friendly size.
+ *
+ * The context uses the solver selected by retinex_pde_solver().
+ *
+ * The work arrays and tables are allocated first; if the memory is
+ * not available for them, NULL is returned instead of abort(), so a
+ * server can refuse an image too large for its memory. The FFTW
+ * allocations are not covered.
+ *
+ * @param nx, ny dimension of the arrays processed with this context
+ * @param nc number of channels
+ *
+ * @return the context, NULL if the memory is not available, abort()
+ * on other errors
+ */
+retinex_pde_ctx_t *retinex_pde_ctx_new_noabort(size_t nx, size_t ny,
+                                               size_t nc)
+{
+    retinex_pde_ctx_t *ctx;
+    int n[2];
+    fftw_r2r_kind kind_fw[2] = { FFTW_REDFT10, FFTW_REDFT10 };
+    fftw_r2r_kind kind_bw[2] = { FFTW_REDFT01, FFTW_REDFT01 };
+
+    if (0 == nx || 0 == ny || 0 == nc) {
+        fprintf(stderr, "the array size must not be 0\n");
+        abort();
+    }
+
+    if (NULL == (ctx = (retinex_pde_ctx_t *)
+                 malloc(sizeof(retinex_pde_ctx_t))))
+        return NULL;
+    ctx->nx = nx;
+    ctx->ny = ny;
+    ctx->nc = nc;
+    ctx->laplacian = laplacian_kernel();
+    ctx->solver = _solver;
+    ctx->mg = NULL;
+    ctx->tol = _tolerance;
+    ctx->warm = 0;
+    ctx->prev_rhs = NULL;
+    ctx->prev_out = NULL;
+    ctx->prev = 0;
+    ctx->cosx = NULL;
+    ctx->cosy = NULL;
+    ctx->precision = _precision;
+    ctx->work = NULL;
+    ctx->work_fw = NULL;
+    ctx->work_bw = NULL;
+    /* every array set, or NULL, for retinex_pde_ctx_free() */
+    ctx->data_tmp = NULL;
+    ctx->data_fft = NULL;
+    ctx->poisson = NULL;
+    ctx->dct_fw = NULL;
+    ctx->dct_bw = NULL;
+
+    if (RETINEX_PDE_SOLVER_MULTIGRID == ctx->solver) {
+        /* no DCT, no padding */
+        ctx->px = nx;
+        ctx->py = ny;
+        if (NULL == (ctx->data_tmp =
+                     (float *) fftwf_malloc(sizeof(float) * nx * ny * nc))
+            || NULL == (ctx->mg = mg_new(nx, ny, nc))) {
+            retinex_pde_ctx_free(ctx);
+            return NULL;
+        }
+        return ctx;
+    }
+
+    /* from here, nx and ny are the DCT size */
+    if (_padding && !_low_memory
+        && RETINEX_PDE_PRECISION_FLOAT == ctx->precision) {
+        nx = fft_size(nx);
+        ny = fft_size(ny);
+    }
+    ctx->px = nx;
+    ctx->py = ny;
+
+    if (RETINEX_PDE_PRECISION_FLOAT != ctx->precision) {
+        /* float laplacians, wider DCT in place */
+        n[0] = (int) ny;
+        n[1] = (int) nx;
+        if (NULL == (ctx->data_tmp =
+                     (float *) fftwf_malloc(sizeof(float) * nx * ny * nc))
+            || NULL == (ctx->poisson =
+                        poisson_table(nx, ny, 1. / (double) (nx * ny)))
+            || 0 != ctx_wide_new(ctx, n, kind_fw, kind_bw)) {
+            retinex_pde_ctx_free(ctx);
+            return NULL;
+        }
+        return ctx;
+    }
+
+    /* allocate the float work arrays, a single one in place */
+    if (NULL == (ctx->data_tmp =
+                 (float *) fftwf_malloc(sizeof(float) * nx * ny * nc))
+        || NULL == (ctx->data_fft = (_low_memory ? ctx->data_tmp :
+                                     (float *) fftwf_malloc(sizeof(float)
+                                                            * nx * ny
+                                                            * nc)))) {
+        retinex_pde_ctx_free(ctx);
+        return NULL;
+    }
+
+    /*
+     * compute the Poisson multipliers, or the cosinus tables
+     * 1. / (nx * ny) is the DCT normalisation term, see libfftw
+     */
+    if (_low_memory) {
+        size_t i;
+
+        ctx->cosx = cos_table(nx);
+        ctx->cosy = cos_table(ny);
+        if (NULL == ctx->cosx || NULL == ctx->cosy) {
+            retinex_pde_ctx_free(ctx);
+            return NULL;
+        }
+        for (i = 0; i < nx; i++)
+            ctx->cosx[i] = 2. - ctx->cosx[i];
+    }
+    else if (NULL == (ctx->poisson =
+                      poisson_table(nx, ny, 1. / (double) (nx * ny)))) {
+        retinex_pde_ctx_free(ctx);
+        return NULL;
+    }
+
+    /*
+     * create the DCT forward and backward plans,
+     * nc 2D transforms of size ny x nx, separated by nx * ny values
+     */
+    n[0] = (int) ny;
+    n[1] = (int) nx;
+#ifdef _OPENMP
+#pragma omp critical (retinex_pde_fftw)
+#endif
+    {
+        ctx->dct_fw = fftwf_plan_many_r2r(2, n, (int) nc,
+                                          ctx->data_tmp, NULL, 1,
+                                          (int) (nx * ny),
+                                          ctx->data_fft, NULL, 1,
+                                          (int) (nx * ny), kind_fw,
+                                          _plan_flags | FFTW_DESTROY_INPUT);
+        ctx->dct_bw = fftwf_plan_many_r2r(2, n, (int) nc,
+                                          ctx->data_fft, NULL, 1,
+                                          (int) (nx * ny),
+                                          ctx->data_tmp, NULL, 1,
+                                          (int) (nx * ny), kind_bw,
+                                          _plan_flags | FFTW_DESTROY_INPUT);
+    }
+    if (NULL == ctx->dct_fw || NULL == ctx->dct_bw) {
+        fprintf(stderr, "fftw planning error\n");
+        abort();
+    }
+
+    return ctx;
+}
+
+/**
+ * @brief allocate and setup a retinex PDE solver context
+ *
+ * Same as retinex_pde_ctx_new_noabort(), abort() if the memory is not
+ * available.
+ *
+ * @param nx, ny dimension of the arrays processed with this context
+ * @param nc number of channels
+ *
+ * @return the context, abort() on error
+ */
+retinex_pde_ctx_t *retinex_pde_ctx_new(size_t nx, size_t ny, size_t nc)
+{
+    retinex_pde_ctx_t *ctx;
+
+    if (NULL == (ctx = retinex_pde_ctx_new_noabort(nx, ny, nc))) {
+        fprintf(stderr, "allocation error\n");
+        abort();
+    }
+    return ctx;
+}
+
+/**
+ * @brief free a retinex PDE solver context
+ *
+ * Same thread-safety as retinex_pde_ctx_new().
+ *
+ * @param ctx the context, may be NULL
+ */
+void retinex_pde_ctx_free(retinex_pde_ctx_t *ctx)
+{
+    if (NULL == ctx)
+        return;
+
+    if (NULL != ctx->dct_fw) {
+#ifdef _OPENMP
+#pragma omp critical (retinex_pde_fftw)
+#endif
+        {
+            fftwf_destroy_plan(ctx->dct_fw);
+            fftwf_destroy_plan(ctx->dct_bw);
+        }
+    }
+    if (NULL != ctx->work)
+        ctx_wide_free(ctx);
+    if (ctx->data_fft != ctx->data_tmp)
+        fftwf_free(ctx->data_fft);
+    fftwf_free(ctx->data_tmp);
+    free(ctx->poisson);
+    free(ctx->cosx);
+    free(ctx->cosy);
+    free(ctx->prev_rhs);
+    free(ctx->prev_out);
+    mg_free(ctx->mg);
+    free(ctx);
+
+    return;
+}
+
+/**
+ * @brief memory used by a solver context
+ *
+ * The size of the work arrays and tables, without the memory used by
+ * the FFTW plans.
+ *
+ * @param ctx the context
+ *
+ * @return the size, in bytes
+ */
+size_t retinex_pde_ctx_memory(const retinex_pde_ctx_t *ctx)
+{
+    size_t size;
+
+    if (NULL == ctx) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
+    }
+
+    size = ctx->px * ctx->py;
+    if (NULL != ctx->mg)
+        return size * ctx->nc * sizeof(float) + mg_memory(ctx->mg);
+    if (NULL != ctx->work)
+        return size * ctx->nc * sizeof(float) + size * sizeof(double)
+            + size * ctx->nc * (RETINEX_PDE_PRECISION_DOUBLE
+                                == ctx->precision ? sizeof(double)
+                                : sizeof(long double))
+            + (NULL != ctx->prev_rhs ? size * ctx->nc * sizeof(float) : 0)
+            + (NULL != ctx->prev_out ? ctx->nx * ctx->ny * ctx->nc
+               * sizeof(float) : 0);
+    if (NULL == ctx->poisson)
+        return size * ctx->nc * sizeof(float)
+            + (ctx->px + ctx->py) * sizeof(double)
+            + (NULL != ctx->prev_rhs ? size * ctx->nc * sizeof(float) : 0)
+            + (NULL != ctx->prev_out ? ctx->nx * ctx->ny * ctx->nc
+               * sizeof(float) : 0);
+    return 2 * size * ctx->nc * sizeof(float) + size * sizeof(double)
+        + (NULL != ctx->prev_rhs ? size * ctx->nc * sizeof(float) : 0)
+        + (NULL != ctx->prev_out ? ctx->nx * ctx->ny * ctx->nc
+           * sizeof(float) : 0);
+}
+
+/**
+ * @brief start each solve from the previous one
+ *
+ * With warm starts, the successive arrays processed by
+ * retinex_pde_ctx_run() are expected to be similar, as the frames of
+ * a video, and each solve reuses the previous one:
+ *
+ * @li a multigrid context starts each solve from its previous
+ *     solution instead of 0, and needs fewer iterations, none if the
+ *     laplacians did not change;
+ * @li the cost of the DCT does not depend on the laplacians, so a DCT
+ *     context still runs a full solve for every array. It only keeps
+ *     a copy of the previous laplacians and solution, and skips the
+ *     DCT when the laplacians are bit-identical, as in a still
+ *     sequence. The result is the same as without warm start, but
+ *     every array pays a comparison and two copies, a net loss unless
+ *     identical arrays are frequent.
+ *
+ * @param ctx the context
+ * @param warm 1 to enable the warm starts, 0 to disable them (default)
+ */
+void retinex_pde_ctx_warm_start(retinex_pde_ctx_t *ctx, int warm)
+{
+    size_t size;
+
+    if (NULL == ctx) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
+    }
+    ctx->warm = warm;
+    ctx->prev = 0;
+
+    if (RETINEX_PDE_SOLVER_DCT != ctx->solver)
+        return;
+    if (warm && NULL == ctx->prev_rhs) {
+        size = ctx->px * ctx->py * ctx->nc;
+        if (NULL == (ctx->prev_rhs = (float *) malloc(sizeof(float) * size))
+            || NULL == (ctx->prev_out = (float *)
+                        malloc(sizeof(float) * ctx->nx * ctx->ny
+                               * ctx->nc))) {
+            fprintf(stderr, "allocation error\n");
+            abort();
+        }
+    }
+    else if (!warm) {
+        free(ctx->prev_rhs);
+        free(ctx->prev_out);
+        ctx->prev_rhs = NULL;
+        ctx->prev_out = NULL;
+    }
+
+    return;
+}
+
+/*
+ * CONTEXT CACHE
+ */
+
+/**
+ * @brief solver context cache
+ *
+ * A small set of solver contexts, by size, to process images of a few
+ * different sizes without creating a new context for each one. When
+ * the cache is full, the least recently used context is replaced.
+ */
+struct retinex_pde_cache_s {
+    size_t size;                /**< number of entries */
+    retinex_pde_ctx_t **ctx;    /**< contexts, NULL if unused */
+    unsigned long *last;        /**< time of last use */
+    unsigned long time;         /**< number of lookups */
+};
+
+/**
+ * @brief allocate a solver context cache
+ *
+ * A cache is not thread-safe, use one cache per thread.
+ *
+ * @param size maximum number of contexts kept in the cache
+ *
+ * @return the cache, abort() on error
+ */
+retinex_pde_cache_t *retinex_pde_cache_new(size_t size)
+{
+    retinex_pde_cache_t *cache;
+    size_t i;
+
+    if (0 == size) {
+        fprintf(stderr, "the cache size must not be 0\n");
+        abort();
+    }
+    if (NULL == (cache = (retinex_pde_cache_t *)
+                 malloc(sizeof(retinex_pde_cache_t)))
+        || NULL == (cache->ctx = (retinex_pde_ctx_t **)
+                    malloc(sizeof(retinex_pde_ctx_t *) * size))
+        || NULL == (cache->last = (unsigned long *)
+                    malloc(sizeof(unsigned long) * size))) {
+        fprintf(stderr, "allocation error\n");
+        abort();
+    }
+    cache->size = size;
+    cache->time = 0;
+    for (i = 0; i < size; i++) {
+        cache->ctx[i] = NULL;
+        cache->last[i] = 0;
+    }
+
+    return cache;
+}
+
+/**
+ * @brief get a solver context from the cache
+ *
+ * The context is created if needed. It belongs to the cache, and is
+ * valid until the next retinex_pde_cache_get() call.
+ *
+ * @param cache context cache
+ * @param nx, ny, nc context dimensions, see retinex_pde_ctx_new()
+ *
+ * @return the context, NULL if the memory is not available, see
+ * retinex_pde_ctx_new_noabort()
+ */
+retinex_pde_ctx_t *retinex_pde_cache_get(retinex_pde_cache_t *cache,
+                                         size_t nx, size_t ny, size_t nc)
+{
+    retinex_pde_ctx_t *ctx;
+    size_t i, lru;
+
+    if (NULL == cache) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
+    }
+    cache->time++;
+
+    /* look for this size, and for the least recently used entry */
+    lru = 0;
+    for (i = 0; i < cache->size; i++) {
+        ctx = cache->ctx[i];
+        if (NULL != ctx && nx == ctx->nx && ny == ctx->ny && nc == ctx->nc) {
+            cache->last[i] = cache->time;
+            return ctx;
+        }
+        if (cache->last[i] < cache->last[lru])
+            lru = i;
+    }
+
+    /* not found, replace the least recently used context */
+    retinex_pde_ctx_free(cache->ctx[lru]);
+    cache->ctx[lru] = retinex_pde_ctx_new_noabort(nx, ny, nc);
+    cache->last[lru] = cache->time;
+
+    return cache->ctx[lru];
+}
+
+/**
+ * @brief free a solver context cache and its contexts
+ *
+ * @param cache the cache, may be NULL
+ */
+void retinex_pde_cache_free(retinex_pde_cache_t *cache)
+{
+    size_t i;
+
+    if (NULL == cache)
+        return;
+
+    for (i = 0; i < cache->size; i++)
+        retinex_pde_ctx_free(cache->ctx[i]);
+    free(cache->ctx);
+    free(cache->last);
+    free(cache);
+
+    return;
+}
+
+/**
+ * @brief release the global FFTW data
+ *
+ * Call this once all the solver contexts have been freed, typically
+ * before the program exits. Any context still in use afterwards is
+ * invalid, and the wisdom is forgotten.
+ */
+void retinex_pde_cleanup(void)
+{
+    fftwf_cleanup();
+    fftw_cleanup();
+#ifndef RETINEX_NO_LONG_DOUBLE
+    fftwl_cleanup();
+#endif
+#ifdef FFTW_THREADS
+    if (_fftw_threads) {
+        fftwf_cleanup_threads();
+        fftw_cleanup_threads();
+#ifndef RETINEX_NO_LONG_DOUBLE
+        fftwl_cleanup_threads();
+#endif
+        _fftw_threads = 0;
+    }
+#endif                          /* FFTW_THREADS */
+
+    return;
+}
+
+/*
+ * RETINEX
+ */
+
+/**
+ * @brief check a solver context and an array
+ */
+static void ctx_check(const retinex_pde_ctx_t *ctx, const float *data)
+{
+    if (NULL == ctx || NULL == data) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
+    }
+}
+
+/**
+ * @brief check the solver of a context
+ */
+static void ctx_check_solver(const retinex_pde_ctx_t *ctx,
+                             retinex_pde_solver_t solver)
+{
+    if (NULL == ctx) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
+    }
+    if (solver != ctx->solver) {
+        fprintf(stderr, "this stage is not used by the context solver\n");
+        abort();
+    }
+}
+
+/**
+ * @brief symmetric extension of an array to a larger size
+ *
+ * The extension is a half-sample symmetry, as in the DCT-II, so the
+ * neighbours of the border pixels are the border pixels themselves,
+ * as in discrete_laplacian_threshold().
+ *
+ * @param data_out output array, size px x py
+ * @param data_in input array, size nx x ny
+ * @param nx, ny, px, py array sizes, with n <= p <= 2n
+ */
+static void pad_symmetric(float *data_out, const float *data_in,
+                          size_t nx, size_t ny, size_t px, size_t py)
+{
+    long y;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (y = 0; y < (long) py; y++) {
+        const float *row_in;
+        float *row_out;
+        size_t x;
+
+        row_in = data_in + ((size_t) y < ny ? (size_t) y
+                            : 2 * ny - 1 - (size_t) y) * nx;
+        row_out = data_out + (size_t) y * px;
+        memcpy(row_out, row_in, nx * sizeof(float));
+        for (x = nx; x < px; x++)
+            row_out[x] = row_in[2 * nx - 1 - x];
+    }
+}
+
+/**
+ * @brief thresholded laplacians of some channels
+ *
+ * The laplacians of the nc channels of data are computed in the
+ * channels c0 to c0 + nc - 1 of the context work array.
+ */
+static void ctx_laplacian(retinex_pde_ctx_t *ctx, const float *data,
+                          float t, size_t c0, size_t nc)
+{
+    size_t c, size, psize;
+    prof_mark_t mark;
+
+    prof_start(&mark);
+    size = ctx->nx * ctx->ny;
+    psize = ctx->px * ctx->py;
+
+    if (ctx->px != ctx->nx || ctx->py != ctx->ny) {
+        /* data -> data_fft, padded, not used until the DCT */
+        for (c = 0; c < nc; c++)
+            pad_symmetric(ctx->data_fft + (c0 + c) * psize, data + c * size,
+                          ctx->nx, ctx->ny, ctx->px, ctx->py);
+        data = ctx->data_fft + c0 * psize;
+    }
+
+    /* data -> data_tmp */
+    for (c = 0; c < nc; c++)
+        (void) discrete_laplacian_threshold(ctx->data_tmp
+                                            + (c0 + c) * psize,
+                                            data + c * psize,
+                                            ctx->px, ctx->py, t,
+                                            ctx->laplacian);
+    prof_stop(&mark, PROF_LAPLACE);
+}
+
+/**
+ * @brief retinex stage 1, thresholded laplacians
+ *
+ * The laplacians of the nc channels of data are computed in the
+ * context work array. With padding, the channels are first extended
+ * by symmetry to the DCT size.
+ *
+ * @param ctx solver context
+ * @param data input array, nc contiguous channels
+ * @param t retinex threshold
+ */
+void retinex_pde_ctx_laplacian(retinex_pde_ctx_t *ctx, const float *data,
+                               float t)
+{
+    ctx_check(ctx, data);
+    ctx_laplacian(ctx, data, t, 0, ctx->nc);
+}
+
+/**
+ * @brief retinex stage 2, forward DCT of the laplacians
+ *
+ * The context work array is destroyed.
+ *
+ * @param ctx solver context
+ */
+void retinex_pde_ctx_dct_fw(retinex_pde_ctx_t *ctx)
+{
+    prof_mark_t mark;
+
+    ctx_check_solver(ctx, RETINEX_PDE_SOLVER_DCT);
+
+    prof_start(&mark);
+    if (NULL != ctx->work)
+        /* data_tmp -> work */
+        ctx_wide_fw(ctx);
+    else {
+        /* data_tmp -> data_fft */
+        DBG_CLOCK_TOGGLE(FOURIER);
+        fftwf_execute(ctx->dct_fw);
+        DBG_CLOCK_TOGGLE(FOURIER);
+    }
+    prof_stop(&mark, PROF_DCT_FW);
+}
+
+/**
+ * @brief retinex stage 3, Poisson equation in Fourier space
+ *
+ * @param ctx solver context
+ */
+void retinex_pde_ctx_poisson(retinex_pde_ctx_t *ctx)
+{
+    prof_mark_t mark;
+
+    ctx_check_solver(ctx, RETINEX_PDE_SOLVER_DCT);
+
+    prof_start(&mark);
+    if (NULL != ctx->work)
+        ctx_wide_poisson(ctx);
+    else if (NULL == ctx->poisson)
+        (void) retinex_poisson_dct_cos(ctx->data_fft, ctx->cosx, ctx->cosy,
+                                       1. / (double) (ctx->px * ctx->py),
+                                       ctx->px, ctx->py, ctx->nc);
+    else
+        (void) retinex_poisson_dct(ctx->data_fft, ctx->poisson,
+                                   ctx->px, ctx->py, ctx->nc);
+    prof_stop(&mark, PROF_POISSON);
+}
+
+/**
+ * @brief retinex stage 4, backward DCT into the output array
+ *
+ * With padding, the result is cropped to the array size.
+ *
+ * @param ctx solver context
+ * @param data output array, nc contiguous channels
+ *
+ * @return data
+ */
+float *retinex_pde_ctx_dct_bw(retinex_pde_ctx_t *ctx, float *data)
+{
+    size_t c, y;
+    prof_mark_t mark;
+
+    ctx_check(ctx, data);
+    ctx_check_solver(ctx, RETINEX_PDE_SOLVER_DCT);
+
+    prof_start(&mark);
+    if (NULL != ctx->work) {
+        /* work -> data, never padded */
+        ctx_wide_bw(ctx, data);
+        prof_stop(&mark, PROF_DCT_BW);
+        return data;
+    }
+
+    if (ctx->px != ctx->nx || ctx->py != ctx->ny) {
+        /* data_fft -> data_tmp -> data, cropped */
+        DBG_CLOCK_TOGGLE(FOURIER);
+        fftwf_execute(ctx->dct_bw);
+        DBG_CLOCK_TOGGLE(FOURIER);
+        for (c = 0; c < ctx->nc; c++)
+            for (y = 0; y < ctx->ny; y++)
+                memcpy(data + (c * ctx->ny + y) * ctx->nx,
+                       ctx->data_tmp + (c * ctx->py + y) * ctx->px,
+                       ctx->nx * sizeof(float));
+        prof_stop(&mark, PROF_DCT_BW);
+        return data;
+    }
+
+    /*
+     * data_fft -> data
+     * the plan can be applied to data directly if it has the same
+     * SIMD alignment as data_tmp, otherwise, or if the plan is in
+     * place, we go through data_tmp
+     */
+    DBG_CLOCK_TOGGLE(FOURIER);
+    if (ctx->data_fft != ctx->data_tmp
+        && fftwf_alignment_of(data) == fftwf_alignment_of(ctx->data_tmp))
+        fftwf_execute_r2r(ctx->dct_bw, ctx->data_fft, data);
+    else {
+        fftwf_execute(ctx->dct_bw);
+        memcpy(data, ctx->data_tmp,
+               sizeof(float) * ctx->nx * ctx->ny * ctx->nc);
+    }
+    DBG_CLOCK_TOGGLE(FOURIER);
+    prof_stop(&mark, PROF_DCT_BW);
+
+    return data;
+}
+
+/**
+ * @brief retinex stages 2 to 4, with the multigrid solver
+ *
+ * The Poisson equation is solved from the laplacians in the context
+ * work array, which is destroyed, into the output array. For the
+ * same result as the DCT solver, the solution is scaled by 4, see
+ * retinex_pde_ctx_solve().
+ *
+ * @param ctx solver context, with the multigrid solver
+ * @param data output array, nc contiguous channels
+ *
+ * @return data
+ */
+float *retinex_pde_ctx_multigrid(retinex_pde_ctx_t *ctx, float *data)
+{
+    size_t i;
+    int cycles;
+    prof_mark_t mark;
+
+    ctx_check(ctx, data);
+    ctx_check_solver(ctx, RETINEX_PDE_SOLVER_MULTIGRID);
+
+    prof_start(&mark);
+    DBG_CLOCK_TOGGLE(POISSON);
+    for (i = 0; i < ctx->nx * ctx->ny * ctx->nc; i++)
+        ctx->data_tmp[i] *= 4.;
+    cycles = mg_solve(ctx->mg, data, ctx->data_tmp, ctx->tol, ctx->warm);
+    DBG_CLOCK_TOGGLE(POISSON);
+    prof_stop(&mark, PROF_MULTIGRID);
+    DBG_PRINTF1("multigrid\t%d cycles\n", cycles);
+    (void) cycles;
+
+    return data;
+}
+
+/**
+ * @brief Poisson solver, with a solver context
+ *
+ * Solve the discrete Poisson equation with Neumann boundary
+ * conditions, as retinex_pde_ctx_run() without the laplacian stage:
+ * the input is the right hand side, the laplacian (center minus
+ * neighbours) of the solution, and the output is the solution, with
+ * a zero mean. With padding, the right hand side is extended by
+ * symmetry, and the solution is approximate.
+ *
+ * The DCT normalization in retinex_pde_ctx_run() scales the solution
+ * by 4, which is irrelevant there but corrected here.
+ *
+ * @param ctx solver context
+ * @param data input/output array, nc contiguous channels
+ *
+ * @return data
+ */
+float *retinex_pde_ctx_solve(retinex_pde_ctx_t *ctx, float *data)
+{
+    size_t c, i, size, psize;
+
+    ctx_check(ctx, data);
+    size = ctx->nx * ctx->ny;
+    psize = ctx->px * ctx->py;
+
+    /* data / 4 -> data_tmp */
+    if (ctx->px != ctx->nx || ctx->py != ctx->ny)
+        for (c = 0; c < ctx->nc; c++)
+            pad_symmetric(ctx->data_tmp + c * psize, data + c * size,
+                          ctx->nx, ctx->ny, ctx->px, ctx->py);
+    else
+        memcpy(ctx->data_tmp, data, ctx->nc * size * sizeof(float));
+    for (i = 0; i < ctx->nc * psize; i++)
+        ctx->data_tmp[i] *= .25;
+
+    if (RETINEX_PDE_SOLVER_MULTIGRID == ctx->solver)
+        return retinex_pde_ctx_multigrid(ctx, data);
+    retinex_pde_ctx_dct_fw(ctx);
+    retinex_pde_ctx_poisson(ctx);
+    return retinex_pde_ctx_dct_bw(ctx, data);
+}
+
+/**
+ * @brief retinex stages 2 to 4, with the context solver
+ *
+ * The Poisson equation is solved from the laplacians in the context
+ * work array into the output array, with the warm starts of
+ * retinex_pde_ctx_warm_start().
+ */
+static void ctx_poisson_solve(retinex_pde_ctx_t *ctx, float *data)
+{
+    if (RETINEX_PDE_SOLVER_MULTIGRID == ctx->solver)
+        (void) retinex_pde_ctx_multigrid(ctx, data);
+    else if (ctx->warm && ctx->prev
+             && 0 == memcmp(ctx->prev_rhs, ctx->data_tmp, sizeof(float)
+                            * ctx->px * ctx->py * ctx->nc)) {
+        /* same laplacians, same solution */
+        memcpy(data, ctx->prev_out,
+               sizeof(float) * ctx->nx * ctx->ny * ctx->nc);
+        DBG_PRINTF0("dct\tskipped\n");
+    }
+    else {
+        if (ctx->warm)
+            memcpy(ctx->prev_rhs, ctx->data_tmp,
+                   sizeof(float) * ctx->px * ctx->py * ctx->nc);
+        retinex_pde_ctx_dct_fw(ctx);
+        retinex_pde_ctx_poisson(ctx);
+        (void) retinex_pde_ctx_dct_bw(ctx, data);
+        if (ctx->warm) {
+            memcpy(ctx->prev_out, data,
+                   sizeof(float) * ctx->nx * ctx->ny * ctx->nc);
+            ctx->prev = 1;
+        }
+    }
+}
+
+/**
+ * @brief retinex PDE implementation, with a solver context
+ *
+ * This function solves the Retinex PDE equation with forward and
+ * backward DCT.
+ *
+ * The input array is processed as follow:
+ *
+ * @li a discrete laplacian is computed with a threshold;
+ * @li this discrete laplacian array is symmetrised in both directions;
+ * @li this data is transformed by forward DFT (both steps can be
+ *     handled by a simple DCT);
+ * @li the DFT data is modified by
+ * @f$ \hat{u}(i, j) = \frac{\hat{F}(i, j)}
+ *                           {4 - 2 \cos(\frac{i \pi}{n_x})
+ *                           - 2 \cos(\frac{j \pi}{n_y})} @f$;
+ * @li this data is transformed by backward DFT.
+ *
+ * No allocation or planning happens here, all the size-dependant
+ * setup is in the context. Different contexts can be used
+ * concurrently, but a context can only run one array at a time.
+ *
+ * All the context channels are processed at once: the laplacians
+ * are computed for every channel, then transformed together and
+ * solved in a single Poisson pass. The four steps are also available
+ * separately, as retinex_pde_ctx_laplacian(), retinex_pde_ctx_dct_fw(),
+ * retinex_pde_ctx_poisson() and retinex_pde_ctx_dct_bw(). With the
+ * multigrid solver, the last three steps are replaced by
+ * retinex_pde_ctx_multigrid(). With retinex_pde_ctx_warm_start(),
+ * each solve reuses the previous one.
+ *
+ * @param ctx solver context, created for the data dimension
+ * @param data input/output array, nc contiguous channels
+ * @param t retinex threshold
+ *
+ * @return data, or NULL if an error occured
+ */
+float *retinex_pde_ctx_run(retinex_pde_ctx_t *ctx, float *data, float t)
+{
+    DBG_CLOCK_RESET(LAPLACE);
+    DBG_CLOCK_RESET(POISSON);
+    DBG_CLOCK_RESET(FOURIER);
+
+    retinex_pde_ctx_laplacian(ctx, data, t);
+    ctx_poisson_solve(ctx, data);
+
+    DBG_PRINTF1("laplace\t%0.2fs\n", DBG_CLOCK_S(LAPLACE));
+    DBG_PRINTF1("poisson\t%0.2fs\n", DBG_CLOCK_S(POISSON));
+    DBG_PRINTF1("fourier\t%0.2fs\n", DBG_CLOCK_S(FOURIER));
+
+    return data;
+}
+
+/**
+ * @brief retinex PDE for several thresholds, with a solver context
+ *
+ * The same input is processed with nt thresholds, as nt calls to
+ * retinex_pde_ctx_run() but with the work shared: the laplacians for
+ * every threshold are computed in the context work array, then
+ * transformed together by the batched DCT plans and solved in a
+ * single Poisson pass.
+ *
+ * The context has nt times the input channels: for nc input
+ * channels, it is created with nt * nc channels, and the output has
+ * the nc channels for the threshold t[0], then the nc channels for
+ * t[1], and so on.
+ *
+ * @param ctx solver context, created for the output dimension
+ * @param out output array, nt * nc contiguous channels
+ * @param in input array, nc contiguous channels
+ * @param t retinex thresholds
+ * @param nt number of thresholds
+ *
+ * @return out, or NULL if an error occured
+ */
+float *retinex_pde_ctx_sweep(retinex_pde_ctx_t *ctx, float *out,
+                             const float *in, const float *t, size_t nt)
+{
+    size_t k, nc;
+
+    ctx_check(ctx, out);
+    ctx_check(ctx, in);
+    if (NULL == t || 0 == nt || 0 != ctx->nc % nt) {
+        fprintf(stderr, "the context channels must be a multiple "
+                "of the number of thresholds\n");
+        abort();
+    }
+    nc = ctx->nc / nt;
+
+    DBG_CLOCK_RESET(LAPLACE);
+    DBG_CLOCK_RESET(POISSON);
+    DBG_CLOCK_RESET(FOURIER);
+
+    for (k = 0; k < nt; k++)
+        ctx_laplacian(ctx, in, t[k], k * nc, nc);
+    ctx_poisson_solve(ctx, out);
+
+    DBG_PRINTF1("laplace\t%0.2fs\n", DBG_CLOCK_S(LAPLACE));
+    DBG_PRINTF1("poisson\t%0.2fs\n", DBG_CLOCK_S(POISSON));
+    DBG_PRINTF1("fourier\t%0.2fs\n", DBG_CLOCK_S(FOURIER));
+
+    return out;
+}
+
+/**
+ * @brief multi-channel retinex PDE implementation
+ *
+ * One-shot version of retinex_pde_ctx_run(), with a temporary solver
+ * context. Use a context to process many arrays of the same size.
+ *
+ * @param data input/output array, nc contiguous channels
+ * @param nx, ny dimension
+ * @param nc number of channels
+ * @param t retinex threshold
+ *
+ * @return data, or NULL if an error occured
+ */
+float *retinex_pde_multi(float *data, size_t nx, size_t ny, size_t nc,
+                         float t)
+{
+    retinex_pde_ctx_t *ctx;
+
+    /* check allocaton */
+    if (NULL == data) {
+        fprintf(stderr, "a pointer is NULL and should not be so\n");
+        abort();
+    }
+
+    ctx = retinex_pde_ctx_new(nx, ny, nc);
+    (void) retinex_pde_ctx_run(ctx, data, t);
+    retinex_pde_ctx_free(ctx);
+
+    return data;
+}
+
+/**
+ * @brief retinex PDE implementation
+ *
+ * Single-channel version of retinex_pde_multi().
+ *
+ * @param data input/output array
+ * @param nx, ny dimension
+ * @param t retinex threshold
+ *
+ * @return data, or NULL if an error occured
+ */
+float *retinex_pde(float *data, size_t nx, size_t ny, float t)
+{
+    return retinex_pde_multi(data, nx, ny, 1, t);
 }
@@ -5,7 +5,62 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+
+/** opaque retinex PDE solver context */
+typedef struct retinex_pde_ctx_s retinex_pde_ctx_t;
+
+/** opaque solver context cache */
+typedef struct retinex_pde_cache_s retinex_pde_cache_t;
+
+/** DCT planning rigor, see the FFTW planner flags */
+typedef enum retinex_pde_plan_e {
+    RETINEX_PDE_PLAN_ESTIMATE = 0,
+    RETINEX_PDE_PLAN_MEASURE = 1,
+    RETINEX_PDE_PLAN_PATIENT = 2
+} retinex_pde_plan_t;
+
+/** Poisson solver */
+typedef enum retinex_pde_solver_e {
+    RETINEX_PDE_SOLVER_DCT = 0,         /**< DCT, exact (default) */
+    RETINEX_PDE_SOLVER_MULTIGRID = 1    /**< multigrid, iterative */
+} retinex_pde_solver_t;
+
+/** DCT precision, the images are float arrays */
+typedef enum retinex_pde_precision_e {
+    RETINEX_PDE_PRECISION_FLOAT = 0,    /**< float (default) */
+    RETINEX_PDE_PRECISION_DOUBLE = 1,   /**< double DCT */
+    RETINEX_PDE_PRECISION_LONG_DOUBLE = 2       /**< long double DCT */
+} retinex_pde_precision_t;
+
 /* retinex_pde_lib.c */
+void retinex_pde_threads(int nthreads);
+void retinex_pde_plan_rigor(retinex_pde_plan_t plan);
+void retinex_pde_padding(int padding);
+void retinex_pde_low_memory(int low);
+void retinex_pde_solver(retinex_pde_solver_t solver);
+void retinex_pde_tolerance(double tol);
+void retinex_pde_precision(retinex_pde_precision_t precision);
+int retinex_pde_wisdom_load(const char *fname);
+int retinex_pde_wisdom_save(const char *fname);
+retinex_pde_ctx_t *retinex_pde_ctx_new_noabort(size_t nx, size_t ny, size_t nc);
+retinex_pde_ctx_t *retinex_pde_ctx_new(size_t nx, size_t ny, size_t nc);
+void retinex_pde_ctx_free(retinex_pde_ctx_t *ctx);
+size_t retinex_pde_ctx_memory(const retinex_pde_ctx_t *ctx);
+void retinex_pde_ctx_warm_start(retinex_pde_ctx_t *ctx, int warm);
+retinex_pde_cache_t *retinex_pde_cache_new(size_t size);
+retinex_pde_ctx_t *retinex_pde_cache_get(retinex_pde_cache_t *cache, size_t nx, size_t ny, size_t nc);
+void retinex_pde_cache_free(retinex_pde_cache_t *cache);
+void retinex_pde_cleanup(void);
+void retinex_pde_ctx_laplacian(retinex_pde_ctx_t *ctx, const float *data, float t);
+void retinex_pde_ctx_dct_fw(retinex_pde_ctx_t *ctx);
+void retinex_pde_ctx_poisson(retinex_pde_ctx_t *ctx);
+float *retinex_pde_ctx_dct_bw(retinex_pde_ctx_t *ctx, float *data);
+float *retinex_pde_ctx_multigrid(retinex_pde_ctx_t *ctx, float *data);
+float *retinex_pde_ctx_solve(retinex_pde_ctx_t *ctx, float *data);
+float *retinex_pde_ctx_run(retinex_pde_ctx_t *ctx, float *data, float t);
+float *retinex_pde_ctx_sweep(retinex_pde_ctx_t *ctx, float *out, const float *in, const float *t, size_t nt);
+float *retinex_pde_multi(float *data, size_t nx, size_t ny, size_t nc, float t);
 float *retinex_pde(float *data, size_t nx, size_t ny, float t);
 
 #ifdef __cplusplus
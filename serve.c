@@ -0,0 +1,483 @@
+/*
+ * Copyright 2009-2011 IPOL Image Processing On Line http://www.ipol.im/
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file serve.c
+ * @brief retinex server, on a local Unix socket
+ *
+ * The server accepts connections on a Unix socket, and processes the
+ * requests received on each connection, one after the other, until
+ * the client closes it. A fixed pool of workers handle one connection
+ * each; the pending connections wait in the socket backlog. Each
+ * worker keeps its own solver contexts, by image size, so a request
+ * of an already seen size has no setup cost.
+ *
+ * A request is a header of 7 unsigned 32-bit big-endian integers:
+ * @li magic number, "RTNX" (0x52544e58)
+ * @li payload format, SERVE_RAW or SERVE_PNG
+ * @li retinex threshold, as the bits of an IEEE 754 float
+ * @li nx, ny, nc: image size, SERVE_RAW only, 0 otherwise
+ * @li payload size, in bytes
+ *
+ * followed by the payload: a PNG file, or the float image array
+ * (RRR GGG BBB AAA, native byte order). The response has the same
+ * header, with a status (SERVE_OK or an error) instead of the
+ * threshold, and the payload in the same format as the request: a
+ * PNG file, or the normalized float array. On error, the payload is
+ * empty and the server closes the connection.
+ *
+ * Malformed PNG payloads, not decoded by libpng, and images larger
+ * than SERVE_MAX_SIZE as float arrays get a SERVE_EBADREQ response;
+ * when the memory is not available for the solver, the response is
+ * SERVE_EFAIL. In both cases, the server and the other connections go
+ * on.
+ */
+
+/* POSIX: sockets, fmemopen(), open_memstream() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "retinex_pde_lib.h"
+#include "io_png.h"
+#include "prof.h"
+
+/* ensure consistency */
+#include "serve.h"
+
+/** request and response magic number, "RTNX" */
+#define SERVE_MAGIC 0x52544e58UL
+/** header size, in bytes */
+#define SERVE_HEADER_SIZE (7 * 4)
+/** maximum payload size, in bytes */
+#define SERVE_MAX_SIZE (1UL << 30)
+/** number of solver contexts kept by each worker */
+#define SERVE_CACHE_SIZE 4
+/** pending connections, per worker */
+#define SERVE_BACKLOG 4
+/** connection read and write timeout, in seconds, to see the stop flag */
+#define SERVE_TIMEOUT 1
+
+/** listening socket, closed by the signal handler */
+static int _serve_fd = -1;
+/** stop flag, set by the signal handler */
+static volatile sig_atomic_t _serve_stop = 0;
+
+/**
+ * @brief SIGINT/SIGTERM handler
+ *
+ * Wake the workers blocked in accept(), they will stop. The workers
+ * blocked on a connection see the stop flag after the interrupted
+ * call, or at the next timeout, see serve_timeout().
+ */
+static void serve_signal(int sig)
+{
+    (void) sig;
+    _serve_stop = 1;
+    if (-1 != _serve_fd)
+        (void) shutdown(_serve_fd, SHUT_RDWR);
+    return;
+}
+
+/** read a big-endian 32-bit integer */
+static unsigned long get_u32(const unsigned char *buf)
+{
+    return ((unsigned long) buf[0] << 24) | ((unsigned long) buf[1] << 16)
+        | ((unsigned long) buf[2] << 8) | (unsigned long) buf[3];
+}
+
+/** write a big-endian 32-bit integer */
+static void put_u32(unsigned char *buf, unsigned long val)
+{
+    buf[0] = (unsigned char) ((val >> 24) & 0xff);
+    buf[1] = (unsigned char) ((val >> 16) & 0xff);
+    buf[2] = (unsigned char) ((val >> 8) & 0xff);
+    buf[3] = (unsigned char) (val & 0xff);
+    return;
+}
+
+/**
+ * @brief set the read and write timeouts of a connection
+ *
+ * An idle client must not keep a worker from stopping: the blocked
+ * reads and writes return every SERVE_TIMEOUT seconds, to check the
+ * stop flag.
+ */
+static void serve_timeout(int fd)
+{
+    struct timeval tv;
+
+    tv.tv_sec = SERVE_TIMEOUT;
+    tv.tv_usec = 0;
+    (void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    (void) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return;
+}
+
+/** interrupted or timed out call, retried until the server stops */
+#define SERVE_RETRY(LEN) (0 > (LEN) && (EINTR == errno || EAGAIN == errno \
+                                         || EWOULDBLOCK == errno))
+
+/**
+ * @brief read exactly size bytes
+ *
+ * @return 0 on success, -1 on error, end of file or server stop
+ */
+static int read_full(int fd, void *buf, size_t size)
+{
+    unsigned char *ptr = (unsigned char *) buf;
+    ssize_t len;
+
+    while (0 < size) {
+        len = read(fd, ptr, size);
+        if (SERVE_RETRY(len)) {
+            if (_serve_stop)
+                return -1;
+            continue;
+        }
+        if (0 >= len)
+            return -1;
+        ptr += len;
+        size -= (size_t) len;
+    }
+    return 0;
+}
+
+/**
+ * @brief write exactly size bytes
+ *
+ * @return 0 on success, -1 on error or server stop
+ */
+static int write_full(int fd, const void *buf, size_t size)
+{
+    const unsigned char *ptr = (const unsigned char *) buf;
+    ssize_t len;
+
+    while (0 < size) {
+        len = write(fd, ptr, size);
+        if (SERVE_RETRY(len)) {
+            if (_serve_stop)
+                return -1;
+            continue;
+        }
+        if (0 >= len)
+            return -1;
+        ptr += len;
+        size -= (size_t) len;
+    }
+    return 0;
+}
+
+/**
+ * @brief send a response
+ *
+ * @return 0 on success, -1 on error
+ */
+static int serve_respond(int fd, unsigned long status, unsigned long format,
+                         size_t nx, size_t ny, size_t nc,
+                         const void *payload, size_t size)
+{
+    unsigned char header[SERVE_HEADER_SIZE];
+
+    put_u32(header, SERVE_MAGIC);
+    put_u32(header + 4, status);
+    put_u32(header + 8, format);
+    put_u32(header + 12, (unsigned long) nx);
+    put_u32(header + 16, (unsigned long) ny);
+    put_u32(header + 20, (unsigned long) nc);
+    put_u32(header + 24, (unsigned long) size);
+
+    if (0 != write_full(fd, header, SERVE_HEADER_SIZE))
+        return -1;
+    if (0 < size && 0 != write_full(fd, payload, size))
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief process a PNG payload
+ *
+ * @param png, png_size PNG file data
+ * @param out, out_size pointers to the PNG response, allocated
+ * @param nxp, nyp, ncp pointers to the image size
+ * @param t retinex threshold
+ * @param process image processing function
+ * @param cache solver context cache of this worker
+ *
+ * @return SERVE_OK or an error status
+ */
+static unsigned long serve_png(void *png, size_t png_size,
+                               char **out, size_t *out_size,
+                               size_t *nxp, size_t *nyp, size_t *ncp,
+                               float t, serve_fn process,
+                               retinex_pde_cache_t *cache)
+{
+    static const unsigned char png_sig[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+    };
+    FILE *fp;
+    float *data;
+    prof_mark_t mark;
+
+    if (8 > png_size || 0 != memcmp(png, png_sig, 8))
+        return SERVE_EBADREQ;
+
+    if (NULL == (fp = fmemopen(png, png_size, "rb")))
+        return SERVE_EFAIL;
+    prof_start(&mark);
+    data = io_png_read_flt_stream_noabort(fp, nxp, nyp, ncp);
+    prof_stop(&mark, PROF_DECODE);
+    (void) fclose(fp);
+    if (NULL == data)
+        return SERVE_EBADREQ;
+    /* the same limit as the raw images */
+    if (SERVE_MAX_SIZE / sizeof(float) / *ncp / *nyp < *nxp) {
+        free(data);
+        return SERVE_EBADREQ;
+    }
+
+    if (0 != process(data, *nxp, *nyp, *ncp, t, cache)) {
+        free(data);
+        return SERVE_EFAIL;
+    }
+
+    if (NULL == (fp = open_memstream(out, out_size))) {
+        free(data);
+        return SERVE_EFAIL;
+    }
+    prof_start(&mark);
+    io_png_write_flt_stream(fp, data, *nxp, *nyp, *ncp);
+    (void) fclose(fp);
+    prof_stop(&mark, PROF_ENCODE);
+    free(data);
+
+    return SERVE_OK;
+}
+
+/**
+ * @brief decode an IEEE 754 float from its bits
+ *
+ * @return the float value, or -1 for infinite and NaN values
+ */
+static float u32_to_float(unsigned long bits)
+{
+    int exp;
+    double val;
+
+    exp = (int) ((bits >> 23) & 0xff);
+    if (0xff == exp)
+        return -1.;
+    if (0 == exp)
+        val = ldexp((double) (bits & 0x7fffffUL), -149);
+    else
+        val = ldexp((double) ((bits & 0x7fffffUL) | 0x800000UL), exp - 150);
+    return (float) ((bits & 0x80000000UL) ? -val : val);
+}
+
+/**
+ * @brief handle the requests of a connection
+ *
+ * @param fd connection socket
+ * @param process image processing function
+ * @param cache solver context cache of this worker
+ */
+static void serve_connection(int fd, serve_fn process,
+                             retinex_pde_cache_t *cache)
+{
+    unsigned char header[SERVE_HEADER_SIZE];
+    unsigned long format, status;
+    size_t nx, ny, nc, size, out_size;
+    float t;
+    void *payload;
+    char *out;
+    int ret;
+
+    /* one request after the other, until the client closes */
+    while (!_serve_stop && 0 == read_full(fd, header, SERVE_HEADER_SIZE)) {
+        format = get_u32(header + 4);
+        t = u32_to_float(get_u32(header + 8));
+        nx = (size_t) get_u32(header + 12);
+        ny = (size_t) get_u32(header + 16);
+        nc = (size_t) get_u32(header + 20);
+        size = (size_t) get_u32(header + 24);
+
+        /* check the header, the payload size and the raw image size */
+        if (SERVE_MAGIC != get_u32(header) || SERVE_MAX_SIZE < size
+            || 0. > t || 1. <= t
+            || (SERVE_RAW != format && SERVE_PNG != format)
+            || (SERVE_RAW == format
+                && (0 == nx || 0 == ny || 1 > nc || 4 < nc
+                    || SERVE_MAX_SIZE / sizeof(float) / nc / ny < nx
+                    || size != nx * ny * nc * sizeof(float)))) {
+            (void) serve_respond(fd, SERVE_EBADREQ, format, 0, 0, 0,
+                                 NULL, 0);
+            return;
+        }
+
+        /* read the payload */
+        if (NULL == (payload = malloc(0 < size ? size : 1))) {
+            (void) serve_respond(fd, SERVE_EFAIL, format, 0, 0, 0,
+                                 NULL, 0);
+            return;
+        }
+        if (0 != read_full(fd, payload, size)) {
+            free(payload);
+            return;
+        }
+
+        /* process and respond */
+        if (SERVE_RAW == format) {
+            if (0 == process((float *) payload, nx, ny, nc, t, cache))
+                ret = serve_respond(fd, SERVE_OK, format, nx, ny, nc,
+                                    payload, size);
+            else {
+                (void) serve_respond(fd, SERVE_EFAIL, format, 0, 0, 0,
+                                     NULL, 0);
+                ret = -1;
+            }
+            free(payload);
+        }
+        else {
+            out = NULL;
+            out_size = 0;
+            status = serve_png(payload, size, &out, &out_size,
+                               &nx, &ny, &nc, t, process, cache);
+            free(payload);
+            if (SERVE_OK == status)
+                ret = serve_respond(fd, SERVE_OK, format, nx, ny, nc,
+                                    out, out_size);
+            else {
+                (void) serve_respond(fd, status, format, 0, 0, 0, NULL, 0);
+                ret = -1;
+            }
+            free(out);
+        }
+        if (0 != ret)
+            return;
+    }
+
+    return;
+}
+
+/**
+ * @brief run the retinex server
+ *
+ * Listen on a Unix socket and process the requests with nworkers
+ * workers (with OpenMP, one worker otherwise) until SIGINT or SIGTERM
+ * is received. An existing socket file is replaced, the socket file
+ * is removed at exit.
+ *
+ * @param path socket file name
+ * @param nworkers number of workers
+ * @param process image processing function
+ *
+ * @return 0 on success, -1 on error
+ */
+int serve(const char *path, int nworkers, serve_fn process)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    struct sigaction sa;
+
+    if (NULL == path || NULL == process || 1 > nworkers) {
+        fprintf(stderr, "bad parameters\n");
+        abort();
+    }
+    if (sizeof(addr.sun_path) <= strlen(path)) {
+        fprintf(stderr, "the socket name is too long\n");
+        return -1;
+    }
+
+    /* replace a stale socket, but no other file */
+    if (0 == stat(path, &st)) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", path);
+            return -1;
+        }
+        (void) unlink(path);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (-1 == (_serve_fd = socket(AF_UNIX, SOCK_STREAM, 0))
+        || 0 != bind(_serve_fd, (struct sockaddr *) &addr, sizeof(addr))
+        || 0 != listen(_serve_fd, SERVE_BACKLOG * nworkers)) {
+        perror("socket");
+        if (-1 != _serve_fd)
+            (void) close(_serve_fd);
+        _serve_fd = -1;
+        return -1;
+    }
+
+    /* clients closing early must not kill the server */
+    (void) signal(SIGPIPE, SIG_IGN);
+    _serve_stop = 0;
+    /* without SA_RESTART, the blocked calls are interrupted */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &serve_signal;
+    (void) sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    (void) sigaction(SIGINT, &sa, NULL);
+    (void) sigaction(SIGTERM, &sa, NULL);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nworkers)
+#endif
+    {
+        retinex_pde_cache_t *cache;
+        int fd;
+
+        cache = retinex_pde_cache_new(SERVE_CACHE_SIZE);
+        while (!_serve_stop) {
+            if (-1 == (fd = accept(_serve_fd, NULL, NULL))) {
+                if (EINTR == errno || ECONNABORTED == errno)
+                    continue;
+                break;
+            }
+            serve_timeout(fd);
+            serve_connection(fd, process, cache);
+            (void) close(fd);
+        }
+        retinex_pde_cache_free(cache);
+    }
+
+    sa.sa_handler = SIG_DFL;
+    (void) sigaction(SIGINT, &sa, NULL);
+    (void) sigaction(SIGTERM, &sa, NULL);
+    (void) close(_serve_fd);
+    _serve_fd = -1;
+    (void) unlink(path);
+
+    return (_serve_stop ? 0 : -1);
+}
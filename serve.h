@@ -0,0 +1,30 @@
+#ifndef _SERVE_H
+#define _SERVE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "retinex_pde_lib.h"
+
+/** payload formats */
+#define SERVE_RAW 0
+#define SERVE_PNG 1
+
+/** response status */
+#define SERVE_OK 0
+#define SERVE_EBADREQ 1
+#define SERVE_EFAIL 2
+
+/** image processing function, see serve() */
+typedef int (*serve_fn) (float *data, size_t nx, size_t ny, size_t nc,
+                         float t, retinex_pde_cache_t *cache);
+
+/* serve.c */
+int serve(const char *path, int nworkers, serve_fn process);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_SERVE_H */
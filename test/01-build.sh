@@ -18,6 +18,298 @@ _test_run() {
 	= "$(md5sum $TEMPFILE)" # Win32 fftw3 has different rounding
 }
 
+# raw files, mapped or streamed
+_test_raw() {
+    TEMPFILE=$(tempfile)
+    TEMPFILE2=$(tempfile)
+    TEMPFILE3=$(tempfile)
+    ./retinex_pde --out f32 0.019607843137254902 data/noisy.png $TEMPFILE
+    ./retinex_pde --in f32 --out u8i:noheader 0.019607843137254902 \
+	$TEMPFILE $TEMPFILE2
+    ./retinex_pde --in f32 --out u8i:noheader 0.019607843137254902 \
+	- - < $TEMPFILE > $TEMPFILE3
+    cmp $TEMPFILE2 $TEMPFILE3 || return 1
+    # tiled, exact in one window, approximate in 256K
+    ./retinex_pde --in f32 --out f32 --tile-mem 64M 0.019607843137254902 \
+	$TEMPFILE $TEMPFILE2
+    ./retinex_pde --in f32 --out f32 0.019607843137254902 \
+	$TEMPFILE $TEMPFILE3
+    cmp $TEMPFILE2 $TEMPFILE3 || return 1
+    ./retinex_pde --in f32 --out f32 --tile-mem 256K 0.019607843137254902 \
+	$TEMPFILE $TEMPFILE2 || return 1
+    # overflowing sizes, rejected
+    printf "%-63s\n" "RAW u8i 4611686018427387905 1 4" > $TEMPFILE
+    head -c 64 /dev/zero >> $TEMPFILE
+    ./retinex_pde --in u8i 0.1 $TEMPFILE $TEMPFILE2 2>&1 \
+	| grep -q "bad raw header" || return 1
+    ./retinex_pde --in u8i 0.1 - $TEMPFILE2 < $TEMPFILE 2>&1 \
+	| grep -q "bad raw header" || return 1
+    ./retinex_pde --in u8i:4611686018427387905x1x4 0.1 $TEMPFILE \
+	$TEMPFILE2 2> /dev/null && return 1
+    rm -f $TEMPFILE $TEMPFILE2 $TEMPFILE3
+}
+
+# fast PNG compression, same pixels
+_test_png_fast() {
+    TEMPFILE=$(tempfile)
+    TEMPFILE2=$(tempfile)
+    ./retinex_pde --out png:fast 0.019607843137254902 data/noisy.png \
+	$TEMPFILE
+    ./retinex_pde --out u8:noheader 0.019607843137254902 $TEMPFILE \
+	$TEMPFILE2
+    ./retinex_pde 0.019607843137254902 data/noisy.png $TEMPFILE
+    ./retinex_pde --out u8:noheader 0.019607843137254902 $TEMPFILE - \
+	| cmp - $TEMPFILE2 || return 1
+    rm -f $TEMPFILE $TEMPFILE2
+}
+
+# 16bit PNG output, read back, same pixels with fast compression
+_test_png16() {
+    TEMPFILE=$(tempfile)
+    TEMPFILE2=$(tempfile)
+    TEMPFILE3=$(tempfile)
+    ./retinex_pde --out png:16 0.019607843137254902 data/noisy.png \
+	$TEMPFILE
+    # IHDR bit depth
+    test 16 -eq $(od -An -tu1 -j24 -N1 $TEMPFILE) || return 1
+    ./retinex_pde --out f32 0.019607843137254902 $TEMPFILE $TEMPFILE2
+    ./retinex_pde --out png:fast:16 0.019607843137254902 data/noisy.png \
+	$TEMPFILE
+    ./retinex_pde --out f32 0.019607843137254902 $TEMPFILE $TEMPFILE3
+    cmp $TEMPFILE2 $TEMPFILE3 || return 1
+    rm -f $TEMPFILE $TEMPFILE2 $TEMPFILE3
+}
+
+# maximum difference of two 8bit raw files of the same size
+_max_diff_u8() {
+    cmp -l $1 $2 | awk '
+	function oct(s, n, i) {
+	    n = 0
+	    for (i = 1; i <= length(s); i++)
+		n = n * 8 + substr(s, i, 1)
+	    return n
+	}
+	{ d = oct($2) - oct($3); if (d < 0) d = -d; if (d > m) m = d }
+	END { print m + 0 }'
+}
+
+# padded DCT (341 to 343), within 2 levels as measured on data/
+_test_pad() {
+    TEMPFILE=$(tempfile)
+    TEMPFILE2=$(tempfile)
+    ./retinex_pde --out u8:noheader 0.019607843137254902 \
+	data/noisy.png $TEMPFILE
+    ./retinex_pde --pad --out u8:noheader 0.019607843137254902 \
+	data/noisy.png $TEMPFILE2 || return 1
+    test 2 -ge $(_max_diff_u8 $TEMPFILE $TEMPFILE2) || return 1
+    rm -f $TEMPFILE $TEMPFILE2
+}
+
+# multigrid solver, within 1 level of the DCT
+_test_multigrid() {
+    TEMPFILE=$(tempfile)
+    TEMPFILE2=$(tempfile)
+    ./retinex_pde --out u8:noheader 0.019607843137254902 \
+	data/noisy.png $TEMPFILE
+    ./retinex_pde --solver multigrid --out u8:noheader \
+	0.019607843137254902 data/noisy.png $TEMPFILE2 || return 1
+    test 1 -ge $(_max_diff_u8 $TEMPFILE $TEMPFILE2) || return 1
+    rm -f $TEMPFILE $TEMPFILE2
+}
+
+# memory-minimal mode, with the peak memory
+_test_low_mem() {
+    TEMPFILE=$(tempfile)
+    ./retinex_pde --low-mem --peak-mem 0.019607843137254902 \
+	data/noisy.png $TEMPFILE 2>&1 | grep -q "^peak memory" || return 1
+    test -s $TEMPFILE || return 1
+    rm -f $TEMPFILE
+}
+
+# PFM and TIFF, float samples without loss, as f32 raw
+_test_float_fmt() {
+    TEMPDIR=$(mktemp -d)
+    ./retinex_pde --out f32 0 data/color.png $TEMPDIR/color.f32
+    ./retinex_pde --in f32 0.019607843137254902 \
+	$TEMPDIR/color.f32 $TEMPDIR/f32.png || return 1
+    for FMT in pfm tiff; do
+	./retinex_pde --out $FMT 0 data/color.png $TEMPDIR/color.$FMT \
+	    || return 1
+	./retinex_pde --in $FMT 0.019607843137254902 \
+	    $TEMPDIR/color.$FMT $TEMPDIR/$FMT.png || return 1
+	cmp $TEMPDIR/$FMT.png $TEMPDIR/f32.png || return 1
+    done
+    # overflowing PFM size, rejected
+    printf "PF\n4611686018427387905 1\n-1.0\n" > $TEMPDIR/bad.pfm
+    head -c 64 /dev/zero >> $TEMPDIR/bad.pfm
+    ./retinex_pde --in pfm 0.1 $TEMPDIR/bad.pfm $TEMPDIR/bad.png 2>&1 \
+	| grep -q "bad PFM header" || return 1
+    # little-endian TIFF, width 1, length 1, strip offsets 8, then
+    # 5 samples or the strip offsets again, rejected
+    TIFF="\111\111\052\000\010\000\000\000\004\000"
+    TIFF="$TIFF\000\001\004\000\001\000\000\000\001\000\000\000"
+    TIFF="$TIFF\001\001\004\000\001\000\000\000\001\000\000\000"
+    TIFF="$TIFF\021\001\004\000\001\000\000\000\010\000\000\000"
+    printf "$TIFF\025\001\003\000\001\000\000\000\005\000\000\000" \
+	> $TEMPDIR/bad.tif
+    printf "\000\000\000\000" >> $TEMPDIR/bad.tif
+    ./retinex_pde --in tiff 0.1 $TEMPDIR/bad.tif $TEMPDIR/bad.png 2>&1 \
+	| grep -q "bad TIFF image" || return 1
+    printf "$TIFF\021\001\004\000\001\000\000\000\010\000\000\000" \
+	> $TEMPDIR/bad.tif
+    printf "\000\000\000\000" >> $TEMPDIR/bad.tif
+    ./retinex_pde --in tiff 0.1 $TEMPDIR/bad.tif $TEMPDIR/bad.png 2>&1 \
+	| grep -q "bad TIFF strips" || return 1
+    rm -rf $TEMPDIR
+}
+
+# JSON stage profile, every stage of a DCT run
+_test_profile() {
+    TEMPFILE=$(tempfile)
+    ./retinex_pde --profile $TEMPFILE.json 0.019607843137254902 \
+	data/noisy.png $TEMPFILE || return 1
+    for STAGE in decode laplace dct_fw poisson dct_bw normalize encode; do
+	grep -q "\"stage\": \"$STAGE\", \"calls\": [1-9]" \
+	    $TEMPFILE.json || return 1
+    done
+    rm -f $TEMPFILE $TEMPFILE.json
+}
+
+# wider DCT precisions, same 8bit output
+_test_precision() {
+    TEMPFILE=$(tempfile)
+    TEMPFILE2=$(tempfile)
+    ./retinex_pde --precision double 0.019607843137254902 \
+	data/noisy.png $TEMPFILE || return 1
+    ./retinex_pde --precision long 0.019607843137254902 \
+	data/noisy.png $TEMPFILE2 || return 1
+    cmp $TEMPFILE $TEMPFILE2 || return 1
+    rm -f $TEMPFILE $TEMPFILE2
+}
+
+# batch of 2 images with 2 workers, same as single images
+_test_batch() {
+    TEMPDIR=$(mktemp -d)
+    mkdir $TEMPDIR/out
+    printf "data/noisy.png\ndata/color.png\n" > $TEMPDIR/list
+    ./retinex_pde -j 2 --batch $TEMPDIR/list 0.019607843137254902 \
+	$TEMPDIR/out || return 1
+    ./retinex_pde --tile-mem 64M --batch $TEMPDIR/list \
+	0.019607843137254902 $TEMPDIR/out 2>/dev/null && return 1
+    for IMG in noisy color; do
+	./retinex_pde 0.019607843137254902 data/$IMG.png $TEMPDIR/$IMG.png
+	cmp $TEMPDIR/out/$IMG.png $TEMPDIR/$IMG.png || return 1
+    done
+    rm -rf $TEMPDIR
+}
+
+# video frames, numbered files and raw stream, same as single images
+_test_video() {
+    TEMPDIR=$(mktemp -d)
+    TEMPFILE=$(tempfile)
+    ./retinex_pde 0.019607843137254902 data/noisy.png $TEMPFILE
+    cp data/noisy.png $TEMPDIR/in1.png
+    cp data/noisy.png $TEMPDIR/in2.png
+    ./retinex_pde --video 0.019607843137254902 \
+	$TEMPDIR/in%d.png $TEMPDIR/out%d.png || return 1
+    cmp $TEMPDIR/out1.png $TEMPFILE || return 1
+    cmp $TEMPDIR/out2.png $TEMPFILE || return 1
+    ./retinex_pde --out f32 0 data/color.png $TEMPDIR/color.f32
+    ./retinex_pde --in f32 --out u8i:noheader 0.019607843137254902 \
+	$TEMPDIR/color.f32 $TEMPFILE
+    cat $TEMPDIR/color.f32 $TEMPDIR/color.f32 \
+	| ./retinex_pde --video --in f32 --out u8i:noheader \
+	0.019607843137254902 - - > $TEMPDIR/out.raw
+    cat $TEMPFILE $TEMPFILE | cmp - $TEMPDIR/out.raw || return 1
+    rm -rf $TEMPDIR $TEMPFILE
+}
+
+# threshold sweep, same as single thresholds
+_test_sweep() {
+    TEMPDIR=$(mktemp -d)
+    ./retinex_pde --thresholds 0.01,0.02,0.05,0.1,0.2 data/noisy.png \
+	$TEMPDIR/out%d.png || return 1
+    ./retinex_pde 0.1 data/noisy.png $TEMPDIR/single.png
+    cmp $TEMPDIR/out3.png $TEMPDIR/single.png || return 1
+    test -f $TEMPDIR/out4.png || return 1
+    rm -rf $TEMPDIR
+}
+
+# server request: socket format T nx ny nc in out, prints the status
+_serve_request() {
+    perl -MIO::Socket::UNIX -e '
+	my ($sock, $fmt, $t, $nx, $ny, $nc, $in, $out) = @ARGV;
+	open(IN, "<", $in) or die; binmode(IN);
+	local $/; my $data = <IN>; close(IN);
+	my $s = IO::Socket::UNIX->new(Peer => $sock) or die;
+	print $s pack("N7", 0x52544e58, ("png" eq $fmt ? 1 : 0),
+		      unpack("L", pack("f", $t)), $nx, $ny, $nc,
+		      length($data)), $data;
+	28 == read($s, my $hdr, 28) or die;
+	my @h = unpack("N7", $hdr);
+	$h[6] == read($s, my $body, $h[6]) or die;
+	open(OUT, ">", $out) or die; binmode(OUT);
+	print OUT $body; close(OUT);
+	print "$h[1]\n";' "$@"
+}
+
+# server, raw and PNG requests same as the CLI, malformed PNG rejected
+_test_serve() {
+    which perl > /dev/null || return 0
+    TEMPDIR=$(mktemp -d)
+    ./retinex_pde --serve $TEMPDIR/sock &
+    PID=$!
+    for I in 1 2 3 4 5; do
+	test -S $TEMPDIR/sock && break
+	sleep 1
+    done
+    # raw request, without the 64 bytes header
+    ./retinex_pde --out f32 0 data/noisy.png $TEMPDIR/in.f32
+    ./retinex_pde --in f32 --out f32:noheader 0.019607843137254902 \
+	$TEMPDIR/in.f32 $TEMPDIR/ref.raw
+    tail -c +65 $TEMPDIR/in.f32 > $TEMPDIR/in.raw
+    set -- $(head -c 64 $TEMPDIR/in.f32)
+    test 0 = $(_serve_request $TEMPDIR/sock raw 0.019607843137254902 \
+	$3 $4 $5 $TEMPDIR/in.raw $TEMPDIR/out.raw) || return 1
+    cmp $TEMPDIR/out.raw $TEMPDIR/ref.raw || return 1
+    # PNG request
+    ./retinex_pde 0.019607843137254902 data/noisy.png $TEMPDIR/ref.png
+    test 0 = $(_serve_request $TEMPDIR/sock png 0.019607843137254902 \
+	0 0 0 data/noisy.png $TEMPDIR/out.png) || return 1
+    cmp $TEMPDIR/out.png $TEMPDIR/ref.png || return 1
+    # truncated PNG, bad request, the server goes on
+    head -c 200 data/noisy.png > $TEMPDIR/bad.png
+    test 1 = $(_serve_request $TEMPDIR/sock png 0.019607843137254902 \
+	0 0 0 $TEMPDIR/bad.png $TEMPDIR/out.png) || return 1
+    test 0 = $(_serve_request $TEMPDIR/sock png 0.019607843137254902 \
+	0 0 0 data/noisy.png $TEMPDIR/out.png) || return 1
+    # an idle client does not keep the server from stopping
+    perl -MIO::Socket::UNIX -e '
+	my $s = IO::Socket::UNIX->new(Peer => $ARGV[0]) or die;
+	sleep 30;' $TEMPDIR/sock &
+    CLIENT=$!
+    sleep 1
+    kill $PID
+    for I in 1 2 3 4 5; do
+	kill -0 $PID 2> /dev/null || break
+	sleep 1
+    done
+    kill $CLIENT
+    kill -0 $PID 2> /dev/null && return 1
+    wait $PID || return 1
+    rm -rf $TEMPDIR
+}
+
+# same results with every laplacian kernel
+_test_simd() {
+    for SIMD in scalar avx2 avx512 neon; do
+	RETINEX_SIMD=$SIMD
+	export RETINEX_SIMD
+	_test_run || return 1
+    done
+    unset RETINEX_SIMD
+}
+
 ################################################
 
 _log_init
@@ -27,6 +319,20 @@ _log make -B debug
 _log _test_run
 _log make -B
 _log _test_run
+_log _test_raw
+_log _test_png_fast
+_log _test_png16
+_log _test_low_mem
+_log _test_pad
+_log _test_multigrid
+_log _test_precision
+_log _test_float_fmt
+_log _test_profile
+_log _test_batch
+_log _test_video
+_log _test_sweep
+_log _test_serve
+_log _test_simd
 _log make
 _log make clean
 _log make
@@ -45,9 +351,10 @@ for CC in cc c++ c89 c99 gcc g++ tcc clang icc suncc \
 	    _log make CC=$CC CFLAGS="-O2 -ffloat-store"\
 		CPPFLAGS="-DNDEBUG -I. -I./win32/include" \
 		LDFLAGS="-L./win32/lib" \
-		LDLIBS="-lpng -lfftw3f-3 -lm"
+		LDLIBS="-lpng -lfftw3f-3 -lfftw3-3 -lfftw3l-3 -lm"
 	    ln -f -s ./win32/bin/libpng3.dll ./win32/bin/zlib1.dll \
-		./win32/bin/libfftw3f-3.dll ./
+		./win32/bin/libfftw3f-3.dll ./win32/bin/libfftw3-3.dll \
+		./win32/bin/libfftw3l-3.dll ./
 	    ;;
 	"icc")
 	    # default icc behaviour is wrong divisions!
@@ -14,6 +14,17 @@ echo "* check memory leaks"
 _log make distclean
 _log make
 _log _test_memcheck ./retinex_pde 5 data/noisy.png /tmp/out.png
+_log _test_memcheck ./retinex_pde --solver multigrid 5 data/noisy.png \
+    /tmp/out.png
+_log _test_memcheck ./retinex_pde --low-mem 5 data/noisy.png /tmp/out.png
+_log _test_memcheck ./retinex_pde --precision double 5 data/noisy.png \
+    /tmp/out.png
+_log _test_memcheck ./retinex_pde --out tiff 5 data/color.png /tmp/out.tif
+_log _test_memcheck ./retinex_pde --in tiff 5 /tmp/out.tif /tmp/out.png
+_log _test_memcheck ./retinex_pde --profile /tmp/out.json 5 data/noisy.png \
+    /tmp/out.png
+_log _test_memcheck ./retinex_pde --thresholds 0.02,0.05,0.1,0.2,0.3 \
+    data/noisy.png /tmp/out%d.png
 
 _log make distclean
 
@@ -0,0 +1,17 @@
+#ifndef _TILE_H
+#define _TILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* tile.c */
+int retinex_tiled(float *out, const float *in, size_t nx, size_t ny, size_t nc, float t, size_t mem);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_TILE_H */